@@ -0,0 +1,73 @@
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "bench.h"
+#include "commons.h"
+
+/* Benchmarked code reads these, as clight would */
+state_t state = {0};
+conf_t conf = {0};
+
+static const bench_t benches[] = {
+    { "solar", bench_solar },
+    { "math", bench_math },
+    { "validate", bench_validate },
+    { "log", bench_log },
+    { "pubsub", bench_pubsub },
+    { "luma", bench_luma },
+};
+
+static bool json;
+static int num_results;
+
+void bench_report(const char *bench, const char *variant, uint64_t ns, size_t iters) {
+    if (json) {
+        printf("%s\n    { \"bench\": \"%s\", \"variant\": \"%s\", \"iters\": %zu, \"ns\": %" PRIu64 ", \"ns_per_iter\": %.2f }",
+               num_results++ ? "," : "", bench, variant, iters, ns, (double)ns / iters);
+    } else {
+        printf("%-10s %-24s %12zu iters %10.2f ns/iter\n", bench, variant, iters, (double)ns / iters);
+    }
+}
+
+void bench_value(const char *bench, const char *variant, double value, const char *unit) {
+    if (json) {
+        printf("%s\n    { \"bench\": \"%s\", \"variant\": \"%s\", \"value\": %.6g, \"unit\": \"%s\" }",
+               num_results++ ? "," : "", bench, variant, value, unit);
+    } else {
+        printf("%-10s %-24s %18.3f %s\n", bench, variant, value, unit);
+    }
+}
+
+/*
+ * Usage: clight-bench [--json] [name...]
+ * Without names, every benchmark is run.
+ * With --json, results are printed as a single JSON object,
+ * to be stored and compared between releases.
+ */
+int main(int argc, char *argv[]) {
+    const size_t num = sizeof(benches) / sizeof(*benches);
+    int num_names = argc - 1;
+    for (int j = 1; j < argc; j++) {
+        if (!strcmp(argv[j], "--json")) {
+            json = true;
+            num_names--;
+        }
+    }
+    
+    if (json) {
+        printf("{\n  \"version\": \"%s\",\n  \"timestamp\": %ld,\n  \"results\": [", VERSION, (long)time(NULL));
+    }
+    for (size_t i = 0; i < num; i++) {
+        bool run = num_names == 0;
+        for (int j = 1; j < argc && !run; j++) {
+            run = !strcmp(argv[j], benches[i].name);
+        }
+        if (run) {
+            benches[i].run();
+        }
+    }
+    if (json) {
+        printf("\n  ]\n}\n");
+    }
+    return 0;
+}
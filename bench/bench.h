@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} bench_t;
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Report a timing, as total ns spent for iters iterations */
+void bench_report(const char *bench, const char *variant, uint64_t ns, size_t iters);
+/* Report any other measured value (eg: a precision or a throughput) */
+void bench_value(const char *bench, const char *variant, double value, const char *unit);
+
+void bench_solar(void);
+void bench_math(void);
+void bench_validate(void);
+void bench_log(void);
+void bench_pubsub(void);
+void bench_luma(void);
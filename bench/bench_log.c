@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "bench.h"
+#include "commons.h"
+
+#define ROUNDS 200000
+
+/*
+ * Measure log_message() cost as seen by callers, ie: formatting a record
+ * and queueing it to writer thread, plus a disabled DEBUG call.
+ * Log is written to a temporary XDG_DATA_HOME; stdout is muted meanwhile,
+ * as log messages are echoed there.
+ */
+void bench_log(void) {
+    char dir[] = "/tmp/clight-bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return;
+    }
+    setenv("XDG_DATA_HOME", dir, 1);
+    
+    fflush(stdout);
+    const int out = dup(STDOUT_FILENO);
+    const int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    
+    open_log();
+    log_level_set(NULL, LOG_LVL_INFO);
+    
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        INFO("Benchmark message %d: %.2lf\n", r, r / 3.0);
+    }
+    const uint64_t info_ns = bench_now_ns() - start;
+    
+    start = bench_now_ns();
+    log_flush();
+    const uint64_t flush_ns = bench_now_ns() - start;
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        DEBUG("Benchmark message %d: %.2lf\n", r, r / 3.0);
+    }
+    const uint64_t debug_ns = bench_now_ns() - start;
+    close_log();
+    
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    
+    bench_report("log", "info", info_ns, ROUNDS);
+    bench_report("log", "flush", flush_ns, 1);
+    bench_report("log", "debug_disabled", debug_ns, ROUNDS);
+    
+    char path[PATH_MAX + 1];
+    snprintf(path, sizeof(path), "%s/clight/clight.log", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/clight", dir);
+    rmdir(path);
+    rmdir(dir);
+}
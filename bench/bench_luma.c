@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include "bench.h"
+#include "luma.h"
+
+#define ROUNDS 50
+#define WIDTH 3840
+#define HEIGHT 2160
+#define ROWS 256                            // same as in-process sampler
+
+/*
+ * Luma reduction of a 4K xRGB frame: full frame vs sampler strided rows,
+ * with scalar kernel and the one picked for this cpu.
+ */
+void bench_luma(void) {
+    uint32_t *frame = malloc((size_t)WIDTH * HEIGHT * sizeof(uint32_t));
+    if (!frame) {
+        return;
+    }
+    srand(0);
+    for (size_t i = 0; i < (size_t)WIDTH * HEIGHT; i++) {
+        frame[i] = rand() & 0xFFFFFF;
+    }
+    volatile uint64_t sink = 0;
+    
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        sink += luma_sum_scalar(frame, (size_t)WIDTH * HEIGHT);
+    }
+    bench_report("luma", "scalar", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        sink += luma_sum(frame, (size_t)WIDTH * HEIGHT);
+    }
+    bench_report("luma", luma_kernel(), bench_now_ns() - start, ROUNDS);
+    
+    const int stride = HEIGHT / ROWS;
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int y = stride / 2; y < HEIGHT; y += stride) {
+            sink += luma_sum(frame + (size_t)y * WIDTH, WIDTH);
+        }
+    }
+    bench_report("luma", "strided", bench_now_ns() - start, ROUNDS);
+    
+    bench_value("luma", "mismatch", luma_sum(frame, (size_t)WIDTH * HEIGHT) != luma_sum_scalar(frame, (size_t)WIDTH * HEIGHT), "bool");
+    (void)sink;
+    free(frame);
+}
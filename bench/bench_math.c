@@ -0,0 +1,50 @@
+#include "bench.h"
+#include "my_math.h"
+
+#define ROUNDS 100000
+
+void bench_math(void) {
+    /* Default ON_AC curve and a single capture of default number of frames */
+    double points[DEF_SIZE_POINTS] = { 0.0, 0.15, 0.29, 0.45, 0.61, 0.74, 0.81, 0.88, 0.93, 0.97, 1.0 };
+    double frames[5] = { 0.41, 0.43, 0.40, 0.44, 0.42 };
+    double params[DEGREE];
+    volatile double sink = 0;
+    
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        polynomialfit(NULL, points, params, DEF_SIZE_POINTS);
+        sink += params[r % DEGREE];
+    }
+    bench_report("math", "polynomialfit", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        frames[r % 5] += 1e-9;
+        sink += compute_average(frames, 5);
+    }
+    bench_report("math", "compute_average", bench_now_ns() - start, ROUNDS);
+    
+    time_t t;
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        calculate_sunrise(45.46, 9.19, &t, r % 2);
+        sink += t;
+    }
+    bench_report("math", "calculate_sunrise", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        calculate_sunset(45.46, 9.19, &t, r % 2);
+        sink += t;
+    }
+    bench_report("math", "calculate_sunset", bench_now_ns() - start, ROUNDS);
+    
+    loc_t from = { 45.46, 9.19 }, to = { 41.90, 12.49 };
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        to.lat += 1e-9;
+        sink += get_distance(&from, &to);
+    }
+    bench_report("math", "get_distance", bench_now_ns() - start, ROUNDS);
+    (void)sink;
+}
@@ -0,0 +1,89 @@
+#include "bench_pubsub.h"
+
+/*
+ * Stub UPOWER: publishes initial AC state once loop is started,
+ * then floods AMBIENT_BR_UPD in batches, each one acked by stub BACKLIGHT
+ * through a CAPTURE_REQ (pubsub queues are bounded).
+ */
+
+static void publish_batch(void);
+
+DECLARE_MSG(upower_msg, UPOWER_UPD);
+DECLARE_MSG(amb_msg, AMBIENT_BR_UPD);
+
+pubsub_bench_t pubsub_bench;
+static size_t sent;
+
+MODULE("BENCH_PUB");
+
+static void init(void) {
+    M_SUB(CAPTURE_REQ);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    
+}
+
+static void publish_batch(void) {
+    for (int i = 0; i < PUBSUB_BATCH; i++) {
+        amb_msg.bl.new = (double)(sent++ % 100) / 100;
+        M_PUB(&amb_msg);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case SYSTEM_UPD:
+        if (msg->ps_msg->type == LOOP_STARTED) {
+            upower_msg.upower.old = -1;
+            upower_msg.upower.new = ON_AC;
+            M_PUB(&upower_msg);
+        }
+        break;
+    case CAPTURE_REQ:
+        /* First ack comes after first backlight set */
+        if (!pubsub_bench.flood_start_ns) {
+            pubsub_bench.flood_start_ns = bench_now_ns();
+        }
+        if (sent < PUBSUB_MSGS) {
+            publish_batch();
+        } else {
+            pubsub_bench.flood_end_ns = bench_now_ns();
+            modules_quit(EXIT_SUCCESS);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Macro benchmarks: run modules loop with stub UPOWER and BACKLIGHT modules.
+ * Results are synthetic, thus prefixed with "stub_": real BACKLIGHT is not linked,
+ * and its Clightd calls answer at once, so they only measure libmodule pubsub
+ * plus BACKLIGHT math; bus latency, that dominates a real first backlight set, is missing.
+ * Modules loop can only be run once: this must be last benchmark.
+ */
+void bench_pubsub(void) {
+    pubsub_bench.start_ns = bench_now_ns();
+    state.looping = true;
+    modules_loop();
+    state.looping = false;
+    
+    if (pubsub_bench.first_set_ns) {
+        bench_value("pubsub", "stub_first_backlight_set", (pubsub_bench.first_set_ns - pubsub_bench.start_ns) / 1e6, "ms");
+    }
+    if (pubsub_bench.flood_end_ns) {
+        const uint64_t ns = pubsub_bench.flood_end_ns - pubsub_bench.flood_start_ns;
+        bench_report("pubsub", "stub_publish_receive", ns, pubsub_bench.received);
+        bench_value("pubsub", "stub_throughput", pubsub_bench.received / (ns / 1e9), "msgs/s");
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "bench.h"
+#include "commons.h"
+
+#define PUBSUB_BATCH 1000                   // messages published before waiting for an ack
+#define PUBSUB_MSGS 200000                  // total messages flooded through pubsub
+
+/* Timeline filled by stub modules while clight-bench runs modules loop */
+typedef struct {
+    uint64_t start_ns;                      // modules loop start
+    uint64_t first_set_ns;                  // first backlight level set through stub bus
+    uint64_t flood_start_ns;                // first flooded message published
+    uint64_t flood_end_ns;                  // last flooded message acked
+    size_t received;                        // flooded messages received
+} pubsub_bench_t;
+
+extern pubsub_bench_t pubsub_bench;
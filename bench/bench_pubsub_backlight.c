@@ -0,0 +1,83 @@
+#include "bench_pubsub.h"
+#include "my_math.h"
+
+/*
+ * Stub BACKLIGHT: on first AC state, performs the same steps as BACKLIGHT
+ * to set a backlight level, with Clightd replaced by a stub bus
+ * that answers immediately with fixed values.
+ * Then counts flooded ambient brightness updates, acking each batch.
+ */
+
+static void stub_bus_capture(double *frames, int num);
+static void stub_bus_set_all(double pct);
+static void set_first_backlight(void);
+
+DECLARE_MSG(ack_msg, CAPTURE_REQ);
+
+MODULE("BENCH_BL");
+
+static void init(void) {
+    double points[DEF_SIZE_POINTS] = { 0.0, 0.15, 0.29, 0.45, 0.61, 0.74, 0.81, 0.88, 0.93, 0.97, 1.0 };
+    polynomialfit(NULL, points, state.fit_parameters[ON_AC], DEF_SIZE_POINTS);
+    
+    M_SUB(UPOWER_UPD);
+    M_SUB(AMBIENT_BR_UPD);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    
+}
+
+static void stub_bus_capture(double *frames, int num) {
+    for (int i = 0; i < num; i++) {
+        frames[i] = 0.4 + 0.01 * i;
+    }
+}
+
+static void stub_bus_set_all(UNUSED double pct) {
+    if (!pubsub_bench.first_set_ns) {
+        pubsub_bench.first_set_ns = bench_now_ns();
+    }
+}
+
+static void set_first_backlight(void) {
+    double frames[5];
+    stub_bus_capture(frames, 5);
+    state.ambient_br = compute_average(frames, 5);
+    
+    /* y = a0 + a1x + a2x^2 */
+    const double b = state.fit_parameters[state.ac_state][0] 
+                    + state.fit_parameters[state.ac_state][1] * state.ambient_br 
+                    + state.fit_parameters[state.ac_state][2] * pow(state.ambient_br, 2);
+    bl_upd up = { .new = clamp(b, 1, 0), .smooth = -1 };
+    if (VALIDATE_REQ(&up)) {
+        stub_bus_set_all(up.new);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case UPOWER_UPD: {
+        upower_upd *up = (upower_upd *)MSG_DATA();
+        state.ac_state = up->new;
+        set_first_backlight();
+        M_PUB(&ack_msg);
+        break;
+    }
+    case AMBIENT_BR_UPD:
+        if (++pubsub_bench.received % PUBSUB_BATCH == 0) {
+            M_PUB(&ack_msg);
+        }
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,114 @@
+#include <math.h>
+#include "bench.h"
+#include "solar.h"
+
+#define DAYS 366
+#define ROUNDS 2000
+#define LEGACY_ZENITH -0.83
+
+/*
+ * Single-precision port of solar_compute() formula, kept here as reference
+ * to measure speed and precision of solar_compute_batch().
+ */
+static int legacy_compute(const float lat, const float lng, enum day_events event, int yday, double *ut) {
+    float lngHour = lng / 15.0;
+    float t = yday + ((event == SUNRISE ? 6.0 : 18.0) - lngHour) / 24.0;
+    float M = (0.9856 * t) - 3.289;
+    float L = fmod(M + 1.916 * sin(M * M_PI / 180.0) + 0.020 * sin(2 * M * M_PI / 180.0) + 282.634, 360.0);
+    float RA = fmod(atan(0.91764 * tan(L * M_PI / 180.0)) * 180.0 / M_PI, 360.0);
+    float Lquadrant = floor(L / 90) * 90;
+    float RAquadrant = floor(RA / 90) * 90;
+    RA += (Lquadrant - RAquadrant);
+    RA = RA / 15.0;
+    float sinDec = 0.39782 * sin(L * M_PI / 180.0);
+    float cosDec = cos(asin(sinDec));
+    float cosH = (sin(LEGACY_ZENITH * M_PI / 180.0) - sinDec * sin(lat * M_PI / 180.0)) / (cosDec * cos(lat * M_PI / 180.0));
+    if ((cosH > 1 && event == SUNRISE) || (cosH < -1 && event == SUNSET)) {
+        return -2;
+    }
+    float H;
+    if (event == SUNRISE) {
+        H = 360.0 - acos(cosH) * 180.0 / M_PI;
+    } else {
+        H = acos(cosH) * 180.0 / M_PI;
+    }
+    H = H / 15.0;
+    float T = H + RA - (0.06571 * t) - 6.622;
+    *ut = fmod(24 + fmod(T - lngHour, 24.0), 24.0);
+    return 0;
+}
+
+void bench_solar(void) {
+    static const double lats[] = { 45.46, 66.0, 69.65, 78.22 };
+    static double day[DAYS], ut[DAYS], cos_h[DAYS];
+    volatile double sink = 0;
+    
+    for (int i = 0; i < DAYS; i++) {
+        day[i] = i;
+    }
+    
+    for (size_t l = 0; l < sizeof(lats) / sizeof(*lats); l++) {
+        const double lat = lats[l], lng = 9.19;
+        
+        uint64_t start = bench_now_ns();
+        for (int r = 0; r < ROUNDS; r++) {
+            for (int i = 0; i < DAYS; i++) {
+                double u = 0;
+                legacy_compute(lat, lng, SUNRISE, i, &u);
+                sink += u;
+            }
+        }
+        const uint64_t legacy_ns = bench_now_ns() - start;
+        
+        start = bench_now_ns();
+        for (int r = 0; r < ROUNDS; r++) {
+            for (int i = 0; i < DAYS; i++) {
+                double u = 0;
+                solar_compute(lat, lng, SUNRISE, SOLAR_ELEV_HORIZON, i, &u);
+                sink += u;
+            }
+        }
+        const uint64_t scalar_ns = bench_now_ns() - start;
+        
+        solar_batch_t b = { DAYS, day, ut, cos_h };
+        start = bench_now_ns();
+        for (int r = 0; r < ROUNDS; r++) {
+            solar_compute_batch(lat, lng, SUNRISE, SOLAR_ELEV_HORIZON, &b);
+            sink += ut[r % DAYS];
+        }
+        const uint64_t batch_ns = bench_now_ns() - start;
+        
+        /* Precision: max difference (in minutes) and number of days where event existence differs */
+        double max_diff = 0;
+        int flips = 0;
+        for (int i = 0; i < DAYS; i++) {
+            double u = 0;
+            const int legacy_ok = legacy_compute(lat, lng, SUNRISE, i, &u) == 0 && !isnan(u);
+            const int ok = cos_h[i] >= -1.0 && cos_h[i] <= 1.0;
+            if (legacy_ok != ok) {
+                flips++;
+            } else if (ok) {
+                double diff = fabs(u - ut[i]) * 60;
+                if (diff > 12 * 60) {
+                    diff = 24 * 60 - diff;
+                }
+                if (diff > max_diff) {
+                    max_diff = diff;
+                }
+            }
+        }
+        
+        char variant[32];
+        snprintf(variant, sizeof(variant), "max_diff/%.2f", lat);
+        bench_value("solar", variant, max_diff, "min");
+        snprintf(variant, sizeof(variant), "existence_flips/%.2f", lat);
+        bench_value("solar", variant, flips, "days");
+        snprintf(variant, sizeof(variant), "legacy_float/%.2f", lat);
+        bench_report("solar", variant, legacy_ns, (size_t)ROUNDS * DAYS);
+        snprintf(variant, sizeof(variant), "double_scalar/%.2f", lat);
+        bench_report("solar", variant, scalar_ns, (size_t)ROUNDS * DAYS);
+        snprintf(variant, sizeof(variant), "double_batch/%.2f", lat);
+        bench_report("solar", variant, batch_ns, (size_t)ROUNDS * DAYS);
+    }
+    (void)sink;
+}
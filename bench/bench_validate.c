@@ -0,0 +1,68 @@
+#include "bench.h"
+#include "commons.h"
+
+#define ROUNDS 1000000
+
+/*
+ * Requests are validated by VALIDATE_REQ on each received request:
+ * measure dispatch through each validator, for a valid request.
+ * Requests are reset each round, as validators fill their default values.
+ */
+void bench_validate(void) {
+    volatile int sink = 0;
+    
+    state.ac_state = ON_AC;
+    state.day_time = DAY;
+    state.display_state = DISPLAY_ON;
+    state.current_loc = (loc_t){ 45.46, 9.19 };
+    
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        loc_upd up = { .new = { 41.90, 12.49 } };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "loc", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        upower_upd up = { .new = ON_BATTERY };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "upower", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        timeout_upd up = { .new = 30, .state = -1, .daytime = -1 };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "timeout", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        temp_upd up = { .new = 4000, .daytime = -1, .smooth = -1 };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "temp", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        curve_upd up = { .state = -1, .num_points = DEF_SIZE_POINTS };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "curve", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        bl_upd up = { .new = 0.5, .smooth = -1 };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "backlight", bench_now_ns() - start, ROUNDS);
+    
+    start = bench_now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        display_upd up = { .new = DISPLAY_DIMMED };
+        sink += VALIDATE_REQ(&up);
+    }
+    bench_report("validate", "display", bench_now_ns() - start, ROUNDS);
+    (void)sink;
+}
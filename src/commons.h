@@ -6,6 +6,11 @@
 #include <errno.h>
 #include <math.h>
 #include <pwd.h>
+
+/* Each source file caches a pointer to its module log level on first log */
+#define CLIGHT_LOG_LVL (*(clight_log_lvl ? clight_log_lvl : (clight_log_lvl = log_level_ref(__FILENAME__))))
+static __attribute__((unused)) const int *clight_log_lvl;
+
 #include "public.h"
 #include "validations.h"
 #include "log.h"
@@ -20,6 +25,7 @@
 #define LON_UNDEFINED 181.0                 // Undefined (ie: unset) value for longitude
 #define MINIMUM_CLIGHTD_VERSION_MAJ 4       // Clightd minimum required maj version
 #define MINIMUM_CLIGHTD_VERSION_MIN 2       // Clightd minimum required min version -> Backlight.Changed signal
+#define MAX_GAMMA_OUTPUTS 8                 // max number of per-output gamma targets
 
 /** Generic structs **/
 
@@ -41,14 +47,26 @@ typedef struct {
     int no_auto_calib;                      // disable automatic calibration for both BACKLIGHT and GAMMA
     double shutter_threshold;               // capture values below this threshold will be considered "shuttered"
     int pause_on_lid_closed;              // whether clight should inhibit autocalibration on lid closed
+    int phase_timeout[SIZE_AC][SIZE_PHASES]; // capture timeouts for each twilight phase
+    int has_phase_timeouts[SIZE_AC];        // whether phase_timeout are used in place of daytime/event ones
 } bl_conf_t;
 
 typedef struct {
     int disabled;                           // disable keyboard backlight automatic calibration (where supported)
     int dim;                                // whether DPMS/Dimmer should switch keyboard off
     double amb_br_thres;                    // Ambient brightness high threshold 
+    double regression_points[MAX_SIZE_POINTS];  // keyboard backlight curve over ambient brightness
+    int num_points;                         // number of points of keyboard backlight curve
+    int no_smooth;                          // disable smooth keyboard backlight transitions
+    double trans_step;                      // every smooth transition step (as a fraction of max level)
+    int trans_timeout;                      // every smooth transition timeout (ms)
 } kbd_conf_t;
 
+typedef struct {
+    char display[NAME_MAX + 1];             // X display of this output (eg: ":0.1")
+    int temp[SIZE_STATES];                  // output temperature for each daytime
+} gamma_out_conf_t;
+
 typedef struct {
     int disabled;
     int temp[SIZE_STATES];                  // screen temperature for each daytime
@@ -57,6 +75,10 @@ typedef struct {
     int trans_timeout;                      // every gamma transition timeout value, used when smooth GAMMA transitions are enabled
     int long_transition;                    // flag to enable a very long smooth transition for gamma (redshift-like)
     int ambient_gamma;                      // enable gamma adjustments based on ambient backlight
+    gamma_out_conf_t outputs[MAX_GAMMA_OUTPUTS]; // additional outputs, each one with its own temperatures
+    int num_outputs;                        // number of configured additional outputs
+    int phase_temp[SIZE_PHASES];            // screen temperature for each twilight phase
+    int has_phase_temps;                    // whether phase_temp are used in place of daytime ones
 } gamma_conf_t;
 
 typedef struct {
@@ -72,6 +94,7 @@ typedef struct {
     int no_smooth[SIZE_DIM];                // disable smooth backlight changes for DIMMER module
     double trans_step[SIZE_DIM];            // every backlight transition step value (in pct), used when smooth DIMMER transitions are enabled
     int trans_timeout[SIZE_DIM];            // every backlight transition timeout value, used when smooth DIMMER transitions are enabled
+    int learn;                              // whether to adapt timeout to how soon user historically comes back after a dim
 } dimmer_conf_t;
 
 typedef struct {
@@ -79,11 +102,20 @@ typedef struct {
     int timeout[SIZE_AC];                   // dpms timeouts
 } dpms_conf_t;
 
+typedef struct {
+    int disabled;                           // set when no command is configured
+    char command[PATH_MAX + 1];             // shell command run once idle for timeout (eg: to lock the session)
+    int timeout[SIZE_AC];                   // idle hook timeouts
+} idle_hook_conf_t;
+
 typedef struct {
     int disabled;
     int timeout[SIZE_AC];                   // screen timeouts
     double contrib;                         // how much does screen-emitted brightness affect ambient brightness (eg 0.1)
     int samples;                            // number of samples used to compute average screen-emitted brightness
+    double ema_alpha;                       // weight of newest sample for exponential moving average; 0 to use plain average
+    int damage_debounce;                    // ms to wait after a screen content change before sampling; <= 0 to sample on fixed timeout
+    int local_sampling;                     // sample screen-emitted brightness in-process instead of through Clightd
 } screen_conf_t;
 
 typedef struct {
@@ -101,12 +133,37 @@ typedef struct {
     daytime_conf_t day_conf;
     dimmer_conf_t dim_conf;
     dpms_conf_t dpms_conf;
+    idle_hook_conf_t hook_conf;
     screen_conf_t screen_conf;
     inh_conf_t inh_conf;
     int verbose;                            // whether verbose mode is enabled
+    int log_max_size;                       // size of clight.log after which it is rotated, in KB; <= 0 to disable rotation
+    int log_max_files;                      // number of log files kept when rotating, including current one
+    int event_log;                          // whether binary event log is enabled
+    int event_log_size;                     // max size of binary event log file, in KB
+    int startup_trace;                      // whether to log a timeline of startup bus probes
+    int local_idle;                         // whether to detect user activity from input devices instead of Clightd
     int wizard;                             // whether wizard mode is enabled
 } conf_t;
 
+/* Per-output GAMMA state, exposed by INTERFACE */
+typedef struct {
+    const char *display;                    // X display of this output (points to its conf)
+    int temp;                               // last temperature set on this output
+    int smooth;                             // whether last temperature change was smooth
+    int step;                               // last transition step
+    int timeout;                            // last transition timeout
+    int long_transitioning;                 // whether this output is in a long (redshift-like) transition
+} gamma_out_t;
+
+/* Last backlight transition requested by BACKLIGHT; a non-smooth one ends as soon as it starts */
+typedef struct {
+    double start_pct;                       // backlight pct when transition started
+    double target_pct;                      // backlight pct transition is heading to
+    uint64_t start;                         // CLOCK_MONOTONIC ms when transition started
+    uint64_t eta;                           // CLOCK_MONOTONIC ms when transition is expected to end
+} bl_trans_t;
+
 /* Global state of program */
 
 /*
@@ -122,19 +179,24 @@ typedef struct {
     int pm_inhibited;                       // whether pm_inhibition is enabled
     int sens_avail;                         // whether a sensor is currently available
     enum day_states day_time;               // whether it is day or night time
+    enum day_phases day_phase;              // current twilight phase
     enum ac_states ac_state;                // is laptop on battery?
     enum lid_states lid_state;              // current lid state
     enum display_states display_state;      // current display state
     enum day_events next_event;             // next daytime event (SUNRISE or SUNSET)
     int event_time_range;
     int current_temp;                       // current GAMMA temp; specially useful when used with conf.ambient_gamma enabled
+    gamma_out_t gamma_outputs[MAX_GAMMA_OUTPUTS]; // current GAMMA state of each additional output
     const char *xauthority;                 // xauthority env variable
     const char *display;                    // DISPLAY env variable
     const char *wl_display;                 // WAYLAND_DISPLAY env variable
+    const char *clightd_display;            // display passed to Clightd GAMMA/SCREEN/DPMS backends: WAYLAND_DISPLAY, or DISPLAY on X
+    const char *clightd_env;                // env passed along with it: XDG_RUNTIME_DIR on Wayland, XAUTHORITY on X
     time_t day_events[SIZE_EVENTS];         // today events (sunrise/sunset)
     loc_t current_loc;                      // current user location
     double fit_parameters[SIZE_AC][DEGREE]; // best-fit parameters for each sensor, for each AC state
-    double current_bl_pct;                  // current backlight pct
+    double current_bl_pct;                  // current backlight pct, following smooth transitions progress
+    bl_trans_t bl_trans;                    // current (or last) backlight transition
     double current_kbd_pct;                 // current keyboard backlight pct
     double ambient_br;                      // last ambient brightness captured from CLIGHTD Sensor
     double screen_comp;                     // current screen-emitted brightness compensation
@@ -1,7 +1,6 @@
 #include <libconfig.h>
 #include "config.h"
 
-static void init_config_file(enum CONFIG file, char *filename);
 
 static void load_backlight_settings(config_t *cfg, bl_conf_t *bl_conf);
 static void load_sensor_settings(config_t *cfg, sensor_conf_t *sens_conf);
@@ -10,6 +9,7 @@ static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf);
 static void load_day_settings(config_t *cfg, daytime_conf_t *day_conf);
 static void load_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf);
 static void load_dpms_settings(config_t *cfg, dpms_conf_t *dpms_conf);
+static void load_hook_settings(config_t *cfg, idle_hook_conf_t *hook_conf);
 static void load_screen_settings(config_t *cfg, screen_conf_t *screen_conf);
 static void load_inh_settings(config_t *cfg, inh_conf_t *inh_conf);
 
@@ -20,10 +20,11 @@ static void store_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf);
 static void store_daytime_settings(config_t *cfg, daytime_conf_t *day_conf);
 static void store_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf);
 static void store_dpms_settings(config_t *cfg, dpms_conf_t *dpms_conf);
+static void store_hook_settings(config_t *cfg, idle_hook_conf_t *hook_conf);
 static void store_screen_settings(config_t *cfg, screen_conf_t *screen_conf);
 static void store_inh_settings(config_t *cfg, inh_conf_t *inh_conf);
 
-static void init_config_file(enum CONFIG file, char *filename) {
+void init_config_file(enum CONFIG file, char *filename) {
     int len = 0;
     switch (file) {
         case LOCAL:
@@ -79,6 +80,29 @@ static void load_backlight_settings(config_t *cfg, bl_conf_t *bl_conf) {
                 WARN("Wrong number of backlight 'batt_timeouts' array elements.\n");
             }
         }
+        
+        /* Load capture timeouts for each twilight phase, overriding daytime/event ones */
+        if ((timeouts = config_setting_get_member(bl, "ac_phase_timeouts"))) {
+            if (config_setting_length(timeouts) == SIZE_PHASES) {
+                for (int i = 0; i < SIZE_PHASES; i++) {
+                    bl_conf->phase_timeout[ON_AC][i] = config_setting_get_int_elem(timeouts, i);
+                }
+                bl_conf->has_phase_timeouts[ON_AC] = true;
+            } else {
+                WARN("Wrong number of backlight 'ac_phase_timeouts' array elements.\n");
+            }
+        }
+        
+        if ((timeouts = config_setting_get_member(bl, "batt_phase_timeouts"))) {
+            if (config_setting_length(timeouts) == SIZE_PHASES) {
+                for (int i = 0; i < SIZE_PHASES; i++) {
+                    bl_conf->phase_timeout[ON_BATTERY][i] = config_setting_get_int_elem(timeouts, i);
+                }
+                bl_conf->has_phase_timeouts[ON_BATTERY] = true;
+            } else {
+                WARN("Wrong number of backlight 'batt_phase_timeouts' array elements.\n");
+            }
+        }
     }
 }
 
@@ -142,6 +166,22 @@ static void load_kbd_settings(config_t *cfg, kbd_conf_t *kbd_conf) {
         config_setting_lookup_bool(kbd, "disabled", &kbd_conf->disabled);
         config_setting_lookup_bool(kbd, "dim", &kbd_conf->dim);
         config_setting_lookup_float(kbd, "ambient_br_thresh", &kbd_conf->amb_br_thres);
+        config_setting_lookup_bool(kbd, "no_smooth_transition", &kbd_conf->no_smooth);
+        config_setting_lookup_float(kbd, "trans_step", &kbd_conf->trans_step);
+        config_setting_lookup_int(kbd, "trans_timeout", &kbd_conf->trans_timeout);
+        
+        config_setting_t *points;
+        if ((points = config_setting_get_member(kbd, "regression_points"))) {
+            const int len = config_setting_length(points);
+            if (len > 0 && len <= MAX_SIZE_POINTS) {
+                kbd_conf->num_points = len;
+                for (int i = 0; i < len; i++) {
+                    kbd_conf->regression_points[i] = config_setting_get_float_elem(points, i);
+                }
+            } else {
+                WARN("Wrong number of keyboard 'regression_points' array elements.\n");
+            }
+        }
     }
 }
 
@@ -155,6 +195,47 @@ static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
         config_setting_lookup_bool(gamma, "long_transition", &gamma_conf->long_transition);
         config_setting_lookup_bool(gamma, "ambient_gamma", &gamma_conf->ambient_gamma);
         
+        config_setting_t *phase_temps;
+        /* Load screen temperatures for each twilight phase, overriding daytime ones */
+        if ((phase_temps = config_setting_get_member(gamma, "phase_temps"))) {
+            if (config_setting_length(phase_temps) == SIZE_PHASES) {
+                for (int i = 0; i < SIZE_PHASES; i++) {
+                    gamma_conf->phase_temp[i] = config_setting_get_int_elem(phase_temps, i);
+                }
+                gamma_conf->has_phase_temps = true;
+            } else {
+                WARN("Wrong number of gamma 'phase_temps' array elements.\n");
+            }
+        }
+        
+        config_setting_t *outputs;
+        /* Load additional outputs, each one with its own display and temperatures */
+        if ((outputs = config_setting_get_member(gamma, "outputs"))) {
+            const int len = config_setting_length(outputs);
+            if (len <= MAX_GAMMA_OUTPUTS) {
+                gamma_conf->num_outputs = 0;
+                for (int i = 0; i < len; i++) {
+                    config_setting_t *out = config_setting_get_elem(outputs, i);
+                    gamma_out_conf_t *out_conf = &gamma_conf->outputs[gamma_conf->num_outputs];
+                    const char *display;
+                    config_setting_t *temps = config_setting_get_member(out, "temp");
+                    if (config_setting_lookup_string(out, "display", &display) == CONFIG_TRUE && 
+                        temps && config_setting_length(temps) == SIZE_STATES) {
+                        
+                        strncpy(out_conf->display, display, sizeof(out_conf->display) - 1);
+                        for (int j = 0; j < SIZE_STATES; j++) {
+                            out_conf->temp[j] = config_setting_get_int_elem(temps, j);
+                        }
+                        gamma_conf->num_outputs++;
+                    } else {
+                        WARN("Wrong gamma 'outputs' element %d.\n", i);
+                    }
+                }
+            } else {
+                WARN("Wrong number of gamma 'outputs' list elements.\n");
+            }
+        }
+        
         if ((gamma = config_setting_get_member(gamma, "temp"))) {
             if (config_setting_length(gamma) == SIZE_STATES) {
                 for (int i = 0; i < SIZE_STATES; i++) {
@@ -190,6 +271,7 @@ static void load_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf) {
     if (dim) {
         config_setting_lookup_bool(dim, "disabled", &dim_conf->disabled);
         config_setting_lookup_float(dim, "dimmed_pct", &dim_conf->dimmed_pct);
+        config_setting_lookup_bool(dim, "learn", &dim_conf->learn);
         
         config_setting_t *points, *timeouts;
         /* Load no_smooth_dimmer options */
@@ -258,12 +340,38 @@ static void load_dpms_settings(config_t *cfg, dpms_conf_t *dpms_conf) {
     }
 }
 
+static void load_hook_settings(config_t *cfg, idle_hook_conf_t *hook_conf) {
+    config_setting_t *hook = config_lookup(cfg, "idle_hook");
+    if (hook) {
+        const char *command;
+        if (config_setting_lookup_string(hook, "command", &command) == CONFIG_TRUE) {
+            strncpy(hook_conf->command, command, sizeof(hook_conf->command) - 1);
+        }
+        
+        config_setting_t *timeouts;
+        
+        /* Load idle hook timeouts */
+        if ((timeouts = config_setting_get_member(hook, "timeouts"))) {
+            if (config_setting_length(timeouts) == SIZE_AC) {
+                for (int i = 0; i < SIZE_AC; i++) {
+                    hook_conf->timeout[i] = config_setting_get_int_elem(timeouts, i);
+                }
+            } else {
+                WARN("Wrong number of idle_hook 'timeouts' array elements.\n");
+            }
+        }
+    }
+}
+
 static void load_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
     config_setting_t *screen = config_lookup(cfg, "screen");
     if (screen) {
         config_setting_lookup_bool(screen, "disabled", &screen_conf->disabled);
         config_setting_lookup_float(screen, "contrib", &screen_conf->contrib);
         config_setting_lookup_int(screen, "num_samples", &screen_conf->samples);
+        config_setting_lookup_float(screen, "ema_alpha", &screen_conf->ema_alpha);
+        config_setting_lookup_int(screen, "damage_debounce", &screen_conf->damage_debounce);
+        config_setting_lookup_bool(screen, "local_sampling", &screen_conf->local_sampling);
         
         config_setting_t *timeouts;
         if ((timeouts = config_setting_get_member(screen, "timeouts"))) {
@@ -295,12 +403,17 @@ int read_config(enum CONFIG file, char *config_file) {
     }
     if (access(config_file, F_OK) == -1) {
         WARN("Config file %s not found.\n", config_file);
-        return -1;
+        return -ENOENT;
     }
     
     config_init(&cfg);
     if (config_read_file(&cfg, config_file) == CONFIG_TRUE) {
         config_lookup_bool(&cfg, "verbose", &conf.verbose);
+        config_lookup_int(&cfg, "log_max_size", &conf.log_max_size);
+        config_lookup_int(&cfg, "log_max_files", &conf.log_max_files);
+        config_lookup_bool(&cfg, "event_log", &conf.event_log);
+        config_lookup_int(&cfg, "event_log_size", &conf.event_log_size);
+        config_lookup_bool(&cfg, "local_idle", &conf.local_idle);
         
         load_backlight_settings(&cfg, &conf.bl_conf);
         load_sensor_settings(&cfg, &conf.sens_conf);
@@ -309,13 +422,14 @@ int read_config(enum CONFIG file, char *config_file) {
         load_day_settings(&cfg, &conf.day_conf);
         load_dimmer_settings(&cfg, &conf.dim_conf);
         load_dpms_settings(&cfg, &conf.dpms_conf);
+        load_hook_settings(&cfg, &conf.hook_conf);
         load_screen_settings(&cfg, &conf.screen_conf);
         load_inh_settings(&cfg, &conf.inh_conf);
     } else {
         WARN("Config file: %s at line %d.\n",
              config_error_text(&cfg),
              config_error_line(&cfg));
-        r = -1;
+        r = -EINVAL;
     }
     config_destroy(&cfg);
     return r;
@@ -355,6 +469,20 @@ static void store_backlight_settings(config_t *cfg, bl_conf_t *bl_conf) {
     for (int i = 0; i < SIZE_STATES + 1; i++) {
         config_setting_set_int_elem(setting, -1, bl_conf->timeout[ON_BATTERY][i]);
     }
+    
+    if (bl_conf->has_phase_timeouts[ON_AC]) {
+        setting = config_setting_add(bl, "ac_phase_timeouts", CONFIG_TYPE_ARRAY);
+        for (int i = 0; i < SIZE_PHASES; i++) {
+            config_setting_set_int_elem(setting, -1, bl_conf->phase_timeout[ON_AC][i]);
+        }
+    }
+    
+    if (bl_conf->has_phase_timeouts[ON_BATTERY]) {
+        setting = config_setting_add(bl, "batt_phase_timeouts", CONFIG_TYPE_ARRAY);
+        for (int i = 0; i < SIZE_PHASES; i++) {
+            config_setting_set_int_elem(setting, -1, bl_conf->phase_timeout[ON_BATTERY][i]);
+        }
+    }
 }
 
 static void store_sensors_settings(config_t *cfg, sensor_conf_t *sens_conf) {
@@ -393,6 +521,20 @@ static void store_kbd_settings(config_t *cfg, kbd_conf_t *kbd_conf) {
     
     setting = config_setting_add(kbd, "ambient_br_thresh", CONFIG_TYPE_FLOAT);
     config_setting_set_float(setting, kbd_conf->amb_br_thres);
+    
+    setting = config_setting_add(kbd, "no_smooth_transition", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, kbd_conf->no_smooth);
+    
+    setting = config_setting_add(kbd, "trans_step", CONFIG_TYPE_FLOAT);
+    config_setting_set_float(setting, kbd_conf->trans_step);
+    
+    setting = config_setting_add(kbd, "trans_timeout", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, kbd_conf->trans_timeout);
+    
+    setting = config_setting_add(kbd, "regression_points", CONFIG_TYPE_ARRAY);
+    for (int i = 0; i < kbd_conf->num_points; i++) {
+        config_setting_set_float_elem(setting, -1, kbd_conf->regression_points[i]);
+    }
 }
 
 static void store_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
@@ -417,6 +559,28 @@ static void store_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
     for (int i = 0; i < SIZE_STATES; i++) {
         config_setting_set_int_elem(setting, -1, gamma_conf->temp[i]);
     }
+    
+    if (gamma_conf->has_phase_temps) {
+        setting = config_setting_add(gamma, "phase_temps", CONFIG_TYPE_ARRAY);
+        for (int i = 0; i < SIZE_PHASES; i++) {
+            config_setting_set_int_elem(setting, -1, gamma_conf->phase_temp[i]);
+        }
+    }
+    
+    if (gamma_conf->num_outputs > 0) {
+        config_setting_t *outputs = config_setting_add(gamma, "outputs", CONFIG_TYPE_LIST);
+        for (int i = 0; i < gamma_conf->num_outputs; i++) {
+            config_setting_t *out = config_setting_add(outputs, NULL, CONFIG_TYPE_GROUP);
+            
+            setting = config_setting_add(out, "display", CONFIG_TYPE_STRING);
+            config_setting_set_string(setting, gamma_conf->outputs[i].display);
+            
+            setting = config_setting_add(out, "temp", CONFIG_TYPE_ARRAY);
+            for (int j = 0; j < SIZE_STATES; j++) {
+                config_setting_set_int_elem(setting, -1, gamma_conf->outputs[i].temp[j]);
+            }
+        }
+    }
 }
 
 static void store_daytime_settings(config_t *cfg, daytime_conf_t *day_conf) {
@@ -461,6 +625,9 @@ static void store_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf) {
     setting = config_setting_add(dimmer, "dimmed_pct", CONFIG_TYPE_FLOAT);
     config_setting_set_float(setting, dim_conf->dimmed_pct);
     
+    setting = config_setting_add(dimmer, "learn", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, dim_conf->learn);
+    
     setting = config_setting_add(dimmer, "timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_AC; i++) {
         config_setting_set_int_elem(setting, -1, dim_conf->timeout[i]);
@@ -476,6 +643,18 @@ static void store_dpms_settings(config_t *cfg, dpms_conf_t *dpms_conf) {
     }
 }
 
+static void store_hook_settings(config_t *cfg, idle_hook_conf_t *hook_conf) {
+    config_setting_t *hook = config_setting_add(cfg->root, "idle_hook", CONFIG_TYPE_GROUP);
+    
+    config_setting_t *setting = config_setting_add(hook, "command", CONFIG_TYPE_STRING);
+    config_setting_set_string(setting, hook_conf->command);
+    
+    setting = config_setting_add(hook, "timeouts", CONFIG_TYPE_ARRAY);
+    for (int i = 0; i < SIZE_AC; i++) {
+        config_setting_set_int_elem(setting, -1, hook_conf->timeout[i]);
+    }
+}
+
 static void store_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
     config_setting_t *screen = config_setting_add(cfg->root, "screen", CONFIG_TYPE_GROUP);
     
@@ -485,6 +664,15 @@ static void store_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
     setting = config_setting_add(screen, "contrib", CONFIG_TYPE_FLOAT);
     config_setting_set_float(setting, screen_conf->contrib);
     
+    setting = config_setting_add(screen, "ema_alpha", CONFIG_TYPE_FLOAT);
+    config_setting_set_float(setting, screen_conf->ema_alpha);
+    
+    setting = config_setting_add(screen, "damage_debounce", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, screen_conf->damage_debounce);
+    
+    setting = config_setting_add(screen, "local_sampling", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, screen_conf->local_sampling);
+    
     setting = config_setting_add(screen, "timeouts", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_AC; i++) {
         config_setting_set_int_elem(setting, -1, screen_conf->timeout[i]);
@@ -515,6 +703,21 @@ int store_config(enum CONFIG file) {
     config_setting_t *setting = config_setting_add(cfg.root, "verbose", CONFIG_TYPE_BOOL);
     config_setting_set_bool(setting, conf.verbose);
     
+    setting = config_setting_add(cfg.root, "log_max_size", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, conf.log_max_size);
+    
+    setting = config_setting_add(cfg.root, "log_max_files", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, conf.log_max_files);
+    
+    setting = config_setting_add(cfg.root, "event_log", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, conf.event_log);
+    
+    setting = config_setting_add(cfg.root, "event_log_size", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, conf.event_log_size);
+    
+    setting = config_setting_add(cfg.root, "local_idle", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, conf.local_idle);
+    
     store_backlight_settings(&cfg, &conf.bl_conf);
     store_sensors_settings(&cfg, &conf.sens_conf);
     store_kbd_settings(&cfg, &conf.kbd_conf);
@@ -522,6 +725,7 @@ int store_config(enum CONFIG file) {
     store_daytime_settings(&cfg, &conf.day_conf);
     store_dimmer_settings(&cfg, &conf.dim_conf);
     store_dpms_settings(&cfg, &conf.dpms_conf);
+    store_hook_settings(&cfg, &conf.hook_conf);
     store_screen_settings(&cfg, &conf.screen_conf);
     store_inh_settings(&cfg, &conf.inh_conf);
     
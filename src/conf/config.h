@@ -4,5 +4,6 @@
 
 enum CONFIG { GLOBAL, LOCAL, CUSTOM };
 
+void init_config_file(enum CONFIG file, char *filename);
 int read_config(enum CONFIG file, char *config_file);
 int store_config(enum CONFIG file);
@@ -0,0 +1,143 @@
+#include <glob.h>
+#include <libconfig.h>
+#include <module/map.h>
+#include "monitors.h"
+#include "config.h"
+
+static void init_monitors_path(enum CONFIG file, char *pattern);
+static int load_monitors_dir(enum CONFIG file, gamma_conf_t *gamma_conf);
+static void load_monitor(const char *path, gamma_conf_t *gamma_conf);
+
+static map_t *mon_map;                      // monitor serial -> mon_conf_t
+
+static void init_monitors_path(enum CONFIG file, char *pattern) {
+    switch (file) {
+        case LOCAL:
+            if (getenv("XDG_CONFIG_HOME")) {
+                snprintf(pattern, PATH_MAX, "%s/clight/mon.d/*.conf", getenv("XDG_CONFIG_HOME"));
+            } else {
+                snprintf(pattern, PATH_MAX, "%s/.config/clight/mon.d/*.conf", getpwuid(getuid())->pw_dir);
+            }
+            break;
+        case GLOBAL:
+            snprintf(pattern, PATH_MAX, "%s/clight/mon.d/*.conf", CONFDIR);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Parse every mon.d config file once, indexing overrides by monitor serial,
+ * so that they can be looked up when a monitor appears.
+ * Local files have higher priority: a global file for same serial is ignored.
+ * Monitor gamma settings are appended to gamma_conf additional outputs.
+ * Any previously loaded override is dropped.
+ * Returns number of loaded monitors.
+ */
+int load_monitors(gamma_conf_t *gamma_conf) {
+    destroy_monitors();
+    mon_map = map_new(true, free);
+    if (!mon_map) {
+        return -ENOMEM;
+    }
+    return load_monitors_dir(LOCAL, gamma_conf) + load_monitors_dir(GLOBAL, gamma_conf);
+}
+
+static int load_monitors_dir(enum CONFIG file, gamma_conf_t *gamma_conf) {
+    char pattern[PATH_MAX + 1];
+    init_monitors_path(file, pattern);
+    
+    const int64_t old_len = map_length(mon_map);
+    glob_t gl = {0};
+    if (glob(pattern, GLOB_ERR, NULL, &gl) == 0) {
+        for (size_t i = 0; i < gl.gl_pathc; i++) {
+            load_monitor(gl.gl_pathv[i], gamma_conf);
+        }
+        globfree(&gl);
+    }
+    return map_length(mon_map) - old_len;
+}
+
+static void load_monitor(const char *path, gamma_conf_t *gamma_conf) {
+    config_t cfg;
+    const char *serial;
+    
+    config_init(&cfg);
+    if (config_read_file(&cfg, path) != CONFIG_TRUE) {
+        WARN("Monitor config %s: %s at line %d.\n", path, config_error_text(&cfg), config_error_line(&cfg));
+    } else if (config_lookup_string(&cfg, "serial", &serial) != CONFIG_TRUE || !strlen(serial)) {
+        WARN("Monitor config %s: missing 'serial'.\n", path);
+    } else if (map_has_key(mon_map, serial)) {
+        DEBUG("Monitor config %s: '%s' already configured. Skipping.\n", path, serial);
+    } else {
+        mon_conf_t *mon = malloc(sizeof(mon_conf_t));
+        if (mon) {
+            *mon = (mon_conf_t){ -1.0, -1, -1.0, -1.0 };
+            config_setting_t *setting;
+            if ((setting = config_lookup(&cfg, "backlight"))) {
+                config_setting_lookup_float(setting, "trans_step", &mon->trans_step);
+                config_setting_lookup_int(setting, "trans_timeout", &mon->trans_timeout);
+                config_setting_lookup_float(setting, "shutter_threshold", &mon->shutter_threshold);
+            }
+            if ((setting = config_lookup(&cfg, "dimmer"))) {
+                config_setting_lookup_float(setting, "dimmed_pct", &mon->dimmed_pct);
+            }
+            
+            /* Gamma is set per X display: monitor display becomes an additional gamma output */
+            if ((setting = config_lookup(&cfg, "gamma"))) {
+                const char *display;
+                config_setting_t *temps = config_setting_get_member(setting, "temp");
+                if (gamma_conf->num_outputs == MAX_GAMMA_OUTPUTS) {
+                    WARN("Monitor config %s: too many gamma outputs.\n", path);
+                } else if (config_setting_lookup_string(setting, "display", &display) == CONFIG_TRUE && 
+                           temps && config_setting_length(temps) == SIZE_STATES) {
+                    
+                    gamma_out_conf_t *out_conf = &gamma_conf->outputs[gamma_conf->num_outputs++];
+                    strncpy(out_conf->display, display, sizeof(out_conf->display) - 1);
+                    for (int j = 0; j < SIZE_STATES; j++) {
+                        out_conf->temp[j] = config_setting_get_int_elem(temps, j);
+                    }
+                } else {
+                    WARN("Monitor config %s: wrong 'gamma' settings.\n", path);
+                }
+            }
+            
+            if (mon->trans_step != -1.0 && (mon->trans_step <= 0.0 || mon->trans_step >= 1.0)) {
+                WARN("Monitor config %s: wrong trans_step value. Using global one.\n", path);
+                mon->trans_step = -1.0;
+            }
+            if (mon->trans_timeout < -1) {
+                WARN("Monitor config %s: wrong trans_timeout value. Using global one.\n", path);
+                mon->trans_timeout = -1;
+            }
+            if (mon->shutter_threshold >= 1.0) {
+                WARN("Monitor config %s: wrong shutter_threshold value. Using global one.\n", path);
+                mon->shutter_threshold = -1.0;
+            }
+            if (mon->dimmed_pct > 1.0) {
+                WARN("Monitor config %s: wrong dimmed_pct value. Using global one.\n", path);
+                mon->dimmed_pct = -1.0;
+            }
+            map_put(mon_map, serial, mon);
+            DEBUG("Monitor config %s loaded for '%s'.\n", path, serial);
+        }
+    }
+    config_destroy(&cfg);
+}
+
+/* Overrides for monitor identified by Clightd serial (or syspath), or NULL */
+const mon_conf_t *get_monitor_conf(const char *serial) {
+    return mon_map ? map_get(mon_map, serial) : NULL;
+}
+
+int num_monitor_confs(void) {
+    return mon_map ? map_length(mon_map) : 0;
+}
+
+void destroy_monitors(void) {
+    if (mon_map) {
+        map_free(mon_map);
+        mon_map = NULL;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "commons.h"
+
+/* Per-monitor overrides loaded from mon.d; any value < 0 means "use global one" */
+typedef struct {
+    double trans_step;                      // backlight transition step, for automatic calibration
+    int trans_timeout;                      // backlight transition timeout, for automatic calibration
+    double shutter_threshold;               // captures below this threshold leave monitor backlight untouched
+    double dimmed_pct;                      // backlight level used while screen is dimmed
+} mon_conf_t;
+
+int load_monitors(gamma_conf_t *gamma_conf);
+const mon_conf_t *get_monitor_conf(const char *serial);
+int num_monitor_confs(void);
+void destroy_monitors(void);
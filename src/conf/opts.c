@@ -1,5 +1,7 @@
 #include <popt.h>
 #include "opts.h"
+#include "snapshot.h"
+#include "monitors.h"
 
 static void init_backlight_opts(bl_conf_t *bl_conf);
 static void init_sens_opts(sensor_conf_t *sens_conf);
@@ -8,6 +10,7 @@ static void init_gamma_opts(gamma_conf_t *gamma_conf);
 static void init_daytime_opts(daytime_conf_t *day_conf);
 static void init_dimmer_opts(dimmer_conf_t *dim_conf);
 static void init_dpms_opts(dpms_conf_t *dpms_conf);
+static void init_hook_opts(idle_hook_conf_t *hook_conf);
 static void init_screen_opts(screen_conf_t *screen_conf);
 static void parse_cmd(int argc, char *const argv[], char *conf_file, size_t size);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
@@ -19,9 +22,16 @@ static void check_gamma_conf(gamma_conf_t *gamma_conf);
 static void check_daytime_conf(daytime_conf_t *day_conf);
 static void check_dim_conf(dimmer_conf_t *dim_conf);
 static void check_dpms_conf(dpms_conf_t *dpms_conf);
+static void check_hook_conf(idle_hook_conf_t *hook_conf);
 static void check_screen_conf(screen_conf_t *screen_conf);
 static void check_inh_conf(inh_conf_t *inh_conf);
-static void check_conf(void);
+static void check_conf(bool probe_clightd);
+static void load_opts(const conf_t *running);
+static void keep_modules_state(const conf_t *running);
+
+static int opts_argc;
+static char **opts_argv;
+static char conf_files[CUSTOM + 1][PATH_MAX + 1];   // config files paths, as found by last load
 
 static void init_backlight_opts(bl_conf_t *bl_conf) {
     bl_conf->timeout[ON_AC][DAY] = 10 * 60;
@@ -66,6 +76,12 @@ static void init_sens_opts(sensor_conf_t *sens_conf) {
 
 static void init_kbd_opts(kbd_conf_t *kbd_conf) {
     kbd_conf->amb_br_thres = 1.0;
+    kbd_conf->trans_step = 0.05;
+    kbd_conf->trans_timeout = 30;
+    kbd_conf->num_points = DEF_SIZE_POINTS;
+    memcpy(kbd_conf->regression_points, 
+           (double[]){ 1.0, 0.9, 0.8, 0.7, 0.6, 0.5, 0.4, 0.3, 0.2, 0.1, 0.0 }, 
+           DEF_SIZE_POINTS * sizeof(double));
 }
 
 static void init_gamma_opts(gamma_conf_t *gamma_conf) {
@@ -96,11 +112,17 @@ static void init_dpms_opts(dpms_conf_t *dpms_conf) {
     dpms_conf->timeout[ON_BATTERY] = 300;
 }
 
+static void init_hook_opts(idle_hook_conf_t *hook_conf) {
+    hook_conf->timeout[ON_AC] = 1200;
+    hook_conf->timeout[ON_BATTERY] = 600;
+}
+
 static void init_screen_opts(screen_conf_t *screen_conf) {
     screen_conf->timeout[ON_AC] = 30;
     screen_conf->timeout[ON_BATTERY] = -1; // disabled on battery by default
     screen_conf->contrib = 0.1;
     screen_conf->samples = 10;
+    screen_conf->damage_debounce = 500;
 }
 
 /*
@@ -110,6 +132,34 @@ static void init_screen_opts(screen_conf_t *screen_conf) {
  * Finally, check configuration values and log it.
  */
 void init_opts(int argc, char *argv[]) {
+    opts_argc = argc;
+    opts_argv = argv;
+    load_opts(NULL);
+}
+
+/*
+ * Load config again into new_conf, following same steps as init_opts,
+ * leaving running conf untouched.
+ * Clightd features are not probed again and modules keep their running enabled state.
+ * Parsing fills global conf, thus it is swapped meanwhile:
+ * modules all run on main thread, and log writer thread never reads conf (see log_set_limits()).
+ */
+void reload_opts(conf_t *new_conf) {
+    static conf_t running;
+    
+    running = conf;
+    memset(&conf, 0, sizeof(conf));
+    load_opts(&running);
+    *new_conf = conf;
+    conf = running;
+}
+
+/* Config file path (GLOBAL, LOCAL or CUSTOM), or empty string if it was not set */
+const char *opts_conf_file(enum CONFIG file) {
+    return conf_files[file];
+}
+
+static void load_opts(const conf_t *running) {
     init_backlight_opts(&conf.bl_conf);
     init_sens_opts(&conf.sens_conf);
     init_kbd_opts(&conf.kbd_conf);
@@ -117,22 +167,80 @@ void init_opts(int argc, char *argv[]) {
     init_daytime_opts(&conf.day_conf);
     init_dimmer_opts(&conf.dim_conf);
     init_dpms_opts(&conf.dpms_conf);
+    init_hook_opts(&conf.hook_conf);
     init_screen_opts(&conf.screen_conf);
+    conf.log_max_size = 1024;
+    conf.log_max_files = 3;
+    conf.event_log_size = 1024;
 
-    char conf_file[PATH_MAX + 1] = {0};
+    memset(conf_files, 0, sizeof(conf_files));
+    init_config_file(GLOBAL, conf_files[GLOBAL]);
+    init_config_file(LOCAL, conf_files[LOCAL]);
     
-    read_config(GLOBAL, conf_file);
-    conf_file[0] = 0;
-    read_config(LOCAL, conf_file);
-    conf_file[0] = 0;
-    parse_cmd(argc, argv, conf_file, PATH_MAX);
+    struct timespec start, parse_start, end;
+    uint64_t parse_ns;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* On startup, skip parsing when nothing changed since last merged conf snapshot */
+    if (!running && snapshot_load(opts_argc, opts_argv, conf_files, &parse_ns) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        INFO("Config loaded from snapshot in %.3lf ms (parsing took %.3lf ms).\n", 
+             (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0, parse_ns / 1000000.0);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &parse_start);
+        /* Never snapshot a broken config file: its errors must be logged on each start */
+        bool broken = read_config(GLOBAL, conf_files[GLOBAL]) == -EINVAL;
+        broken |= read_config(LOCAL, conf_files[LOCAL]) == -EINVAL;
+        parse_cmd(opts_argc, opts_argv, conf_files[CUSTOM], PATH_MAX);
+        
+        /* --conf-file option was passed! */
+        if (strlen(conf_files[CUSTOM])) {
+            broken |= read_config(CUSTOM, conf_files[CUSTOM]) == -EINVAL;
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        parse_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + (end.tv_nsec - start.tv_nsec);
+        if (!running) {
+            INFO("Config parsed in %.3lf ms.\n", parse_ns / 1000000.0);
+            if (!broken) {
+                snapshot_store(opts_argc, opts_argv, conf_files, &parse_start, parse_ns);
+            }
+        }
+    }
     
-    /* --conf-file option was passed! */
-    if (strlen(conf_file)) {
-        read_config(CUSTOM, conf_file);
+    /* mon.d files are not part of snapshot: they are parsed on each load */
+    const int num_monitors = load_monitors(&conf.gamma_conf);
+    if (num_monitors > 0) {
+        INFO("Loaded %d monitor config(s).\n", num_monitors);
     }
     
-    check_conf();
+    if (running) {
+        keep_modules_state(running);
+    }
+    check_conf(!running);
+}
+
+/* Modules cannot be started or stopped at runtime: keep their running state */
+static void keep_modules_state(const conf_t *running) {
+    if (conf.bl_conf.disabled != running->bl_conf.disabled ||
+        conf.kbd_conf.disabled != running->kbd_conf.disabled ||
+        conf.gamma_conf.disabled != running->gamma_conf.disabled ||
+        conf.dim_conf.disabled != running->dim_conf.disabled ||
+        conf.dpms_conf.disabled != running->dpms_conf.disabled ||
+        conf.hook_conf.disabled != running->hook_conf.disabled ||
+        conf.screen_conf.disabled != running->screen_conf.disabled ||
+        conf.inh_conf.disabled != running->inh_conf.disabled) {
+        
+        WARN("Enabling or disabling modules requires a restart.\n");
+    }
+    conf.bl_conf.disabled = running->bl_conf.disabled;
+    conf.kbd_conf.disabled = running->kbd_conf.disabled;
+    conf.gamma_conf.disabled = running->gamma_conf.disabled;
+    conf.dim_conf.disabled = running->dim_conf.disabled;
+    conf.dpms_conf.disabled = running->dpms_conf.disabled;
+    conf.hook_conf.disabled = running->hook_conf.disabled;
+    conf.screen_conf.disabled = running->screen_conf.disabled;
+    conf.inh_conf.disabled = running->inh_conf.disabled;
+    conf.wizard = running->wizard;
 }
 
 /*
@@ -162,6 +270,8 @@ static void parse_cmd(int argc, char *const argv[], char *conf_file, size_t size
         {"no-kbd", 0, POPT_ARG_NONE, &conf.kbd_conf.disabled, 100, "Disable keyboard backlight calibration", NULL},
         {"dimmer-pct", 0, POPT_ARG_DOUBLE | POPT_ARGFLAG_SHOW_DEFAULT, &conf.dim_conf.dimmed_pct, 100, "Backlight level used while screen is dimmed, in pergentage", NULL},
         {"verbose", 0, POPT_ARG_NONE, &conf.verbose, 100, "Enable verbose mode", NULL},
+        {"event-log", 0, POPT_ARG_NONE, &conf.event_log, 100, "Enable binary event log", NULL},
+        {"startup-trace", 0, POPT_ARG_NONE, &conf.startup_trace, 100, "Log a timeline of startup bus probes", NULL},
         {"no-auto-calib", 0, POPT_ARG_NONE, &conf.bl_conf.no_auto_calib, 100, "Disable screen backlight automatic calibration", NULL},
         {"shutter-thres", 0, POPT_ARG_DOUBLE | POPT_ARGFLAG_SHOW_DEFAULT, &conf.bl_conf.shutter_threshold, 100, "Threshold to consider a capture as clogged", NULL},
         {"version", 'v', POPT_ARG_NONE, NULL, 5, "Show version info", NULL},
@@ -245,6 +355,12 @@ static int parse_bus_reply(sd_bus_message *reply, UNUSED const char *member,  UN
     return r;
 }
 
+/* Issue Introspect call early, as config is parsed while waiting for it */
+void prefetch_clightd_features(void) {
+    SYSBUS_ARG(introspect_args, CLIGHTD_SERVICE, "/org/clightd/clightd", "org.freedesktop.DBus.Introspectable", "Introspect");
+    call_prefetch(&introspect_args, NULL);
+}
+
 static void check_clightd_features(void) {
     SYSBUS_ARG_REPLY(introspect_args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd", "org.freedesktop.DBus.Introspectable", "Introspect");
     call(&introspect_args, NULL);
@@ -316,12 +432,33 @@ static void check_kbd_conf(kbd_conf_t *kbd_conf) {
         INFO("Disabling KEYBOARD as requested amb_br_thres is <= 0.\n");
         kbd_conf->disabled = true;
     }
+    
+    if (kbd_conf->trans_step <= 0.0f || kbd_conf->trans_step >= 1.0f) {
+        WARN("Wrong keyboard trans_step value. Resetting default value.\n");
+        kbd_conf->trans_step = 0.05;
+    }
+    
+    if (kbd_conf->trans_timeout <= 0) {
+        WARN("Wrong keyboard trans_timeout value. Resetting default value.\n");
+        kbd_conf->trans_timeout = 30;
+    }
+    
+    for (int i = 0; i < kbd_conf->num_points; i++) {
+        if (kbd_conf->regression_points[i] < 0.0 || kbd_conf->regression_points[i] > 1.0) {
+            WARN("Wrong keyboard regression points. Resetting default values.\n");
+            kbd_conf->num_points = DEF_SIZE_POINTS;
+            memcpy(kbd_conf->regression_points, 
+                   (double[]){ 1.0, 0.9, 0.8, 0.7, 0.6, 0.5, 0.4, 0.3, 0.2, 0.1, 0.0 }, 
+                   DEF_SIZE_POINTS * sizeof(double));
+            break;
+        }
+    }
 }
 
 static void check_gamma_conf(gamma_conf_t *gamma_conf) {
-    /* GAMMA requires X */
-    if (!state.display || !state.xauthority) {
-        INFO("Disabling GAMMA on non-X environment.\n");
+    /* GAMMA requires X or Wayland */
+    if (!state.clightd_display || !state.clightd_env) {
+        INFO("Disabling GAMMA on non-X and non-Wayland environment.\n");
         gamma_conf->disabled = true;
     }
     
@@ -347,6 +484,23 @@ static void check_gamma_conf(gamma_conf_t *gamma_conf) {
         WARN("Wrong gamma_trans_timeout value. Resetting default value.\n");
         gamma_conf->trans_timeout = 300;
     }
+    
+    for (int i = 0; i < SIZE_PHASES && gamma_conf->has_phase_temps; i++) {
+        if (gamma_conf->phase_temp[i] < 1000 || gamma_conf->phase_temp[i] > 10000) {
+            WARN("Wrong phase temp value. Disabling phase temperatures.\n");
+            gamma_conf->has_phase_temps = false;
+        }
+    }
+    
+    for (int i = 0; i < gamma_conf->num_outputs; i++) {
+        gamma_out_conf_t *out = &gamma_conf->outputs[i];
+        for (int j = 0; j < SIZE_STATES; j++) {
+            if (out->temp[j] < 1000 || out->temp[j] > 10000) {
+                WARN("Wrong '%s' output temp value. Using global one.\n", out->display);
+                out->temp[j] = gamma_conf->temp[j];
+            }
+        }
+    }
 }
 
 static void check_daytime_conf(daytime_conf_t *day_conf) {
@@ -364,12 +518,35 @@ static void check_daytime_conf(daytime_conf_t *day_conf) {
         day_conf->loc.lon = LON_UNDEFINED;
     }
     
+    int event_mins[SIZE_EVENTS] = { -1, -1 };
     for (int i = 0; i < SIZE_EVENTS; i++) {
         struct tm timeinfo;
-        if (strlen(day_conf->day_events[i]) && 
-            !strptime(day_conf->day_events[i], "%R", &timeinfo)) {
-            
-            memset(day_conf->day_events[i], 0, sizeof(day_conf->day_events[i]));
+        if (strlen(day_conf->day_events[i])) {
+            if (!strptime(day_conf->day_events[i], "%R", &timeinfo)) {
+                memset(day_conf->day_events[i], 0, sizeof(day_conf->day_events[i]));
+            } else {
+                event_mins[i] = timeinfo.tm_hour * 60 + timeinfo.tm_min;
+            }
+        }
+    }
+    
+    /*
+     * With both sunrise and sunset user-set, daytime schedule windows 
+     * (events lasting 2 * event_duration, day and night between them) must not overlap:
+     * sunset must follow sunrise in same day, and day/night must be long enough for events.
+     */
+    if (event_mins[SUNRISE] != -1 && event_mins[SUNSET] != -1) {
+        const int day_len = (event_mins[SUNSET] - event_mins[SUNRISE]) * 60;
+        if (day_len <= 0) {
+            WARN("Sunset before sunrise: a day crossing midnight is not supported. Resetting default values.\n");
+            memset(day_conf->day_events, 0, sizeof(day_conf->day_events));
+        } else {
+            const int night_len = 24 * 60 * 60 - day_len;
+            const int max_duration = (day_len < night_len ? day_len : night_len) / 2;
+            if (day_conf->event_duration > max_duration) {
+                WARN("Event duration too long for sunrise and sunset: events would overlap. Clamping it to %d.\n", max_duration);
+                day_conf->event_duration = max_duration;
+            }
         }
     }
 }
@@ -405,12 +582,6 @@ static void check_dim_conf(dimmer_conf_t *dim_conf) {
 }
 
 static void check_dpms_conf(dpms_conf_t *dpms_conf) {
-    /* DPMS does not work in wayland */
-    if (state.wl_display) {
-        INFO("Disabling DPMS in wayland environment.\n");
-        dpms_conf->disabled = true;
-    }
-    
     if (!conf.dim_conf.disabled) {
         if (dpms_conf->timeout[ON_AC] <= conf.dim_conf.timeout[ON_AC]) {
             WARN("DPMS AC timeout: wrong value (<= dimmer timeout). Resetting default value.\n");
@@ -424,10 +595,16 @@ static void check_dpms_conf(dpms_conf_t *dpms_conf) {
     }
 }
 
+static void check_hook_conf(idle_hook_conf_t *hook_conf) {
+    if (!strlen(hook_conf->command)) {
+        hook_conf->disabled = true;
+    }
+}
+
 static void check_screen_conf(screen_conf_t *screen_conf) {
-    /* SCREEN requires X */
-    if (!state.display || !state.xauthority) {
-        INFO("Disabling SCREEN on non-X environment.\n");
+    /* SCREEN requires X or Wayland */
+    if (!state.clightd_display || !state.clightd_env) {
+        INFO("Disabling SCREEN on non-X and non-Wayland environment.\n");
         screen_conf->disabled = true;
     }
     
@@ -445,6 +622,11 @@ static void check_screen_conf(screen_conf_t *screen_conf) {
         WARN("Wrong screen_samples value. Resetting default value.\n");
         screen_conf->samples = 10;
     }
+    
+    if (screen_conf->ema_alpha < 0 || screen_conf->ema_alpha > 1) {
+        WARN("Wrong screen_ema_alpha value. Resetting default value.\n");
+        screen_conf->ema_alpha = 0.0;
+    }
 }
 
 static void check_inh_conf(inh_conf_t *inh_conf) {
@@ -460,7 +642,7 @@ static void check_inh_conf(inh_conf_t *inh_conf) {
  * It does all needed checks to correctly reset default values
  * in case of wrong options set.
  */
-static void check_conf(void) {
+static void check_conf(bool probe_clightd) {
     /* Wizard mode; disable everything except backlight */
     if (conf.wizard) {
         conf.bl_conf.no_auto_calib = true;
@@ -469,7 +651,7 @@ static void check_conf(void) {
         conf.dim_conf.disabled = true;
         conf.dpms_conf.disabled = true;
         conf.screen_conf.disabled = true;
-    } else {
+    } else if (probe_clightd) {
         /* Disable any not built-in feature in Clightd */
         check_clightd_features();
     }
@@ -490,8 +672,17 @@ static void check_conf(void) {
     if (!conf.dpms_conf.disabled) {
         check_dpms_conf(&conf.dpms_conf);
     }
+    check_hook_conf(&conf.hook_conf);
     if (!conf.screen_conf.disabled) {
         check_screen_conf(&conf.screen_conf);
     }
     check_inh_conf(&conf.inh_conf);
+    if (conf.log_max_files < 1) {
+        WARN("Wrong log_max_files value. Resetting default value.\n");
+        conf.log_max_files = 3;
+    }
+    if (conf.event_log && conf.event_log_size <= 0) {
+        WARN("Wrong event_log_size value. Resetting default value.\n");
+        conf.event_log_size = 1024;
+    }
 }
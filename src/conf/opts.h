@@ -4,4 +4,7 @@
 #include "bus.h"
 
 void init_opts(int argc, char *argv[]);
+void reload_opts(conf_t *new_conf);
+void prefetch_clightd_features(void);
+const char *opts_conf_file(enum CONFIG file);
 
@@ -0,0 +1,203 @@
+#include "reload.h"
+
+/* Field is only read when used: just overwrite it */
+#define RELOAD_COPY(field) \
+do { \
+    if (memcmp(&conf.field, &new_conf->field, sizeof(conf.field))) { \
+        memcpy(&conf.field, &new_conf->field, sizeof(conf.field)); \
+        DEBUG("Reloaded '%s'.\n", #field); \
+        changed++; \
+    } \
+} while (0)
+
+/* Field is sized or consumed once at startup: changing it requires a restart */
+#define RELOAD_RESTART(field) \
+do { \
+    if (memcmp(&conf.field, &new_conf->field, sizeof(conf.field))) { \
+        WARN("Changing '%s' requires a restart.\n", #field); \
+    } \
+} while (0)
+
+static int reload_backlight(const conf_t *new_conf, reload_pub_cb pub);
+static int reload_gamma(const conf_t *new_conf, reload_pub_cb pub);
+static int reload_daytime(const conf_t *new_conf, reload_pub_cb pub);
+static int reload_timeouts(const conf_t *new_conf, reload_pub_cb pub);
+static int reload_others(const conf_t *new_conf);
+
+/*
+ * Apply differences between running conf and new_conf.
+ * Values owned by a module are changed through the same requests used by bus api,
+ * so that modules react to them exactly as they would at runtime;
+ * any other value is directly updated.
+ * Returns number of changed values.
+ */
+int reload_conf(const conf_t *new_conf, reload_pub_cb pub) {
+    int changed = 0;
+    if (!conf.bl_conf.disabled) {
+        changed += reload_backlight(new_conf, pub);
+    }
+    if (!conf.gamma_conf.disabled) {
+        changed += reload_gamma(new_conf, pub);
+    }
+    changed += reload_daytime(new_conf, pub);
+    changed += reload_timeouts(new_conf, pub);
+    changed += reload_others(new_conf);
+    return changed;
+}
+
+static int reload_backlight(const conf_t *new_conf, reload_pub_cb pub) {
+    int changed = 0;
+    for (int i = ON_AC; i < SIZE_AC; i++) {
+        for (int j = DAY; j <= IN_EVENT; j++) {
+            if (conf.bl_conf.timeout[i][j] != new_conf->bl_conf.timeout[i][j]) {
+                pub(&(message_t){ .type = BL_TO_REQ, .to = { .new = new_conf->bl_conf.timeout[i][j], .state = i, .daytime = j } });
+                changed++;
+            }
+        }
+
+        if (conf.bl_conf.has_phase_timeouts[i] != new_conf->bl_conf.has_phase_timeouts[i] ||
+            memcmp(conf.bl_conf.phase_timeout[i], new_conf->bl_conf.phase_timeout[i], sizeof(conf.bl_conf.phase_timeout[i]))) {
+
+            message_t req = { .type = BL_PHASE_TO_REQ, .phase = { .state = i, .enabled = new_conf->bl_conf.has_phase_timeouts[i] } };
+            memcpy(req.phase.values, new_conf->bl_conf.phase_timeout[i], sizeof(req.phase.values));
+            pub(&req);
+            changed++;
+        }
+
+        if (conf.sens_conf.num_points[i] != new_conf->sens_conf.num_points[i] ||
+            memcmp(conf.sens_conf.regression_points[i], new_conf->sens_conf.regression_points[i],
+                   new_conf->sens_conf.num_points[i] * sizeof(double))) {
+
+            /* Points are copied by BACKLIGHT; new_conf must outlive the request */
+            pub(&(message_t){ .type = CURVE_REQ, .curve = { .state = i, .num_points = new_conf->sens_conf.num_points[i],
+                                                            .regression_points = (double *)new_conf->sens_conf.regression_points[i] } });
+            changed++;
+        }
+    }
+
+    if (conf.bl_conf.no_auto_calib != new_conf->bl_conf.no_auto_calib) {
+        pub(&(message_t){ .type = NO_AUTOCALIB_REQ, .nocalib = { .new = new_conf->bl_conf.no_auto_calib } });
+        changed++;
+    }
+
+    RELOAD_COPY(bl_conf.screen_path);
+    RELOAD_COPY(bl_conf.no_smooth);
+    RELOAD_COPY(bl_conf.trans_step);
+    RELOAD_COPY(bl_conf.trans_timeout);
+    RELOAD_COPY(bl_conf.shutter_threshold);
+    RELOAD_COPY(bl_conf.pause_on_lid_closed);
+    RELOAD_COPY(sens_conf.num_captures);
+    RELOAD_COPY(sens_conf.dev_name);
+    RELOAD_COPY(sens_conf.dev_opts);
+    return changed;
+}
+
+static int reload_gamma(const conf_t *new_conf, reload_pub_cb pub) {
+    int changed = 0;
+    /* Transition params first, as TEMP_REQ below will use them */
+    RELOAD_COPY(gamma_conf.no_smooth);
+    RELOAD_COPY(gamma_conf.trans_step);
+    RELOAD_COPY(gamma_conf.trans_timeout);
+    RELOAD_COPY(gamma_conf.long_transition);
+    RELOAD_COPY(gamma_conf.ambient_gamma);
+    RELOAD_RESTART(gamma_conf.outputs);
+    RELOAD_RESTART(gamma_conf.num_outputs);
+
+    for (int i = DAY; i < SIZE_STATES; i++) {
+        if (conf.gamma_conf.temp[i] != new_conf->gamma_conf.temp[i]) {
+            pub(&(message_t){ .type = TEMP_REQ, .temp = { .daytime = i, .new = new_conf->gamma_conf.temp[i], .smooth = -1 } });
+            changed++;
+        }
+    }
+
+    if (conf.gamma_conf.has_phase_temps != new_conf->gamma_conf.has_phase_temps ||
+        memcmp(conf.gamma_conf.phase_temp, new_conf->gamma_conf.phase_temp, sizeof(conf.gamma_conf.phase_temp))) {
+
+        message_t req = { .type = PHASE_TEMP_REQ, .phase = { .enabled = new_conf->gamma_conf.has_phase_temps } };
+        memcpy(req.phase.values, new_conf->gamma_conf.phase_temp, sizeof(req.phase.values));
+        pub(&req);
+        changed++;
+    }
+    return changed;
+}
+
+static int reload_daytime(const conf_t *new_conf, reload_pub_cb pub) {
+    int changed = 0;
+    RELOAD_COPY(day_conf.event_duration);
+
+    for (int i = SUNRISE; i < SIZE_EVENTS; i++) {
+        if (strcmp(conf.day_conf.day_events[i], new_conf->day_conf.day_events[i])) {
+            if (strlen(new_conf->day_conf.day_events[i])) {
+                message_t req = { .type = i == SUNRISE ? SUNRISE_REQ : SUNSET_REQ };
+                strncpy(req.event.event, new_conf->day_conf.day_events[i], sizeof(req.event.event) - 1);
+                pub(&req);
+                changed++;
+            } else {
+                WARN("Unsetting a fixed %s requires a restart.\n", i == SUNRISE ? "sunrise" : "sunset");
+            }
+        }
+    }
+    /* LOCATION module is not even started when a location is set */
+    RELOAD_RESTART(day_conf.loc);
+    return changed;
+}
+
+static int reload_timeouts(const conf_t *new_conf, reload_pub_cb pub) {
+    int changed = 0;
+    for (int i = ON_AC; i < SIZE_AC; i++) {
+        if (!conf.dim_conf.disabled && conf.dim_conf.timeout[i] != new_conf->dim_conf.timeout[i]) {
+            pub(&(message_t){ .type = DIMMER_TO_REQ, .to = { .new = new_conf->dim_conf.timeout[i], .state = i } });
+            changed++;
+        }
+        if (!conf.dpms_conf.disabled && conf.dpms_conf.timeout[i] != new_conf->dpms_conf.timeout[i]) {
+            pub(&(message_t){ .type = DPMS_TO_REQ, .to = { .new = new_conf->dpms_conf.timeout[i], .state = i } });
+            changed++;
+        }
+        if (!conf.screen_conf.disabled && conf.screen_conf.timeout[i] != new_conf->screen_conf.timeout[i]) {
+            pub(&(message_t){ .type = SCR_TO_REQ, .to = { .new = new_conf->screen_conf.timeout[i], .state = i } });
+            changed++;
+        }
+    }
+
+    if (!conf.screen_conf.disabled && conf.screen_conf.contrib != new_conf->screen_conf.contrib) {
+        pub(&(message_t){ .type = CONTRIB_REQ, .contrib = { .new = new_conf->screen_conf.contrib } });
+        changed++;
+    }
+    return changed;
+}
+
+static int reload_others(const conf_t *new_conf) {
+    int changed = 0;
+    RELOAD_COPY(kbd_conf.dim);
+    RELOAD_COPY(kbd_conf.amb_br_thres);
+    RELOAD_COPY(kbd_conf.regression_points);
+    RELOAD_COPY(kbd_conf.num_points);
+    RELOAD_COPY(kbd_conf.no_smooth);
+    RELOAD_COPY(kbd_conf.trans_step);
+    RELOAD_COPY(kbd_conf.trans_timeout);
+    RELOAD_COPY(dim_conf.dimmed_pct);
+    RELOAD_COPY(dim_conf.no_smooth);
+    RELOAD_COPY(dim_conf.trans_step);
+    RELOAD_COPY(dim_conf.trans_timeout);
+    RELOAD_COPY(dim_conf.learn);
+    RELOAD_RESTART(hook_conf);
+    RELOAD_COPY(screen_conf.damage_debounce);
+    RELOAD_RESTART(screen_conf.samples);
+    RELOAD_RESTART(screen_conf.ema_alpha);
+    RELOAD_RESTART(screen_conf.local_sampling);
+    RELOAD_COPY(inh_conf.inhibit_docked);
+    RELOAD_COPY(inh_conf.inhibit_pm);
+    RELOAD_COPY(log_max_size);
+    RELOAD_COPY(log_max_files);
+    RELOAD_RESTART(event_log);
+    RELOAD_COPY(event_log_size);
+    RELOAD_RESTART(local_idle);
+    log_set_limits(conf.log_max_size, conf.log_max_files, conf.event_log_size);
+
+    if (conf.verbose != new_conf->verbose) {
+        conf.verbose = new_conf->verbose;
+        log_level_set(NULL, conf.verbose ? LOG_LVL_DEBUG : LOG_LVL_INFO);
+        changed++;
+    }
+    return changed;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "commons.h"
+
+/* Called for each request needed to apply a reloaded config; req is only valid during the call */
+typedef void (*reload_pub_cb)(const message_t *req);
+
+int reload_conf(const conf_t *new_conf, reload_pub_cb pub);
@@ -0,0 +1,163 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "CLSN"
+
+/* Identity of a config source file; a missing file has size -1 */
+typedef struct {
+    char path[PATH_MAX + 1];
+    int64_t mtime_ns;
+    int64_t size;
+    uint64_t ino;
+} snapshot_src_t;
+
+/* Snapshot file is a snapshot_hdr_t immediately followed by merged conf_t */
+typedef struct {
+    char magic[4];
+    char version[16];                       // clight version that wrote the snapshot
+    uint32_t conf_size;                     // sizeof(conf_t) of the writer
+    uint64_t argv_hash;                     // cmdline options are merged in conf too
+    snapshot_src_t srcs[CUSTOM + 1];        // config files merged in conf
+    uint64_t parse_ns;                      // time taken by full parse
+    uint64_t checksum;                      // checksum of conf
+} snapshot_hdr_t;
+
+static void snapshot_path(char *path);
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len);
+static uint64_t argv_hash(int argc, char *argv[]);
+static void stat_src(snapshot_src_t *src, const char *path);
+
+static void snapshot_path(char *path) {
+    if (getenv("XDG_CACHE_HOME")) {
+        snprintf(path, PATH_MAX, "%s/clight.snapshot", getenv("XDG_CACHE_HOME"));
+    } else {
+        snprintf(path, PATH_MAX, "%s/.cache/clight.snapshot", getpwuid(getuid())->pw_dir);
+    }
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t argv_hash(int argc, char *argv[]) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    /* Skip program name */
+    for (int i = 1; i < argc; i++) {
+        h = fnv1a(h, argv[i], strlen(argv[i]) + 1);
+    }
+    return h;
+}
+
+static void stat_src(snapshot_src_t *src, const char *path) {
+    struct stat st;
+    memset(src, 0, sizeof(*src));
+    strncpy(src->path, path, PATH_MAX);
+    if (strlen(path) && stat(path, &st) == 0) {
+        src->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        src->size = st.st_size;
+        src->ino = st.st_ino;
+    } else {
+        src->size = -1;
+    }
+}
+
+/*
+ * Load merged conf from snapshot, if it was written by this clight version,
+ * with same cmdline and global/local config files paths (passed in files),
+ * and none of its config files changed since then.
+ * Custom config file path is copied to files.
+ * Returns 0 on success, leaving conf untouched otherwise.
+ */
+int snapshot_load(int argc, char *argv[], char files[][PATH_MAX + 1], uint64_t *parse_ns) {
+    char path[PATH_MAX + 1];
+    snapshot_path(path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int ret = -1;
+    struct stat st;
+    const size_t size = sizeof(snapshot_hdr_t) + sizeof(conf_t);
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)size) {
+        const snapshot_hdr_t *hdr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (hdr != MAP_FAILED) {
+            const conf_t *snap_conf = (const conf_t *)(hdr + 1);
+            ret = 0;
+            if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+                strncmp(hdr->version, VERSION, sizeof(hdr->version)) ||
+                hdr->conf_size != sizeof(conf_t) ||
+                hdr->argv_hash != argv_hash(argc, argv) ||
+                strcmp(hdr->srcs[GLOBAL].path, files[GLOBAL]) ||
+                strcmp(hdr->srcs[LOCAL].path, files[LOCAL])) {
+
+                ret = -1;
+            }
+            for (int i = GLOBAL; i <= CUSTOM && ret == 0; i++) {
+                snapshot_src_t src;
+                stat_src(&src, hdr->srcs[i].path);
+                if (memcmp(&src, &hdr->srcs[i], sizeof(src))) {
+                    DEBUG("%s changed since last config snapshot.\n", strlen(src.path) ? src.path : "Config file");
+                    ret = -1;
+                }
+            }
+            if (ret == 0 && hdr->checksum != fnv1a(0xcbf29ce484222325ULL, snap_conf, sizeof(conf_t))) {
+                WARN("Corrupted config snapshot %s.\n", path);
+                ret = -1;
+            }
+            if (ret == 0) {
+                memcpy(&conf, snap_conf, sizeof(conf_t));
+                strncpy(files[CUSTOM], hdr->srcs[CUSTOM].path, PATH_MAX);
+                *parse_ns = hdr->parse_ns;
+            }
+            munmap((void *)hdr, size);
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+/*
+ * Store current merged conf, with identity of config files it was parsed from.
+ * Snapshot is skipped if any of them was modified while being parsed,
+ * as it could hold its old content.
+ * Snapshot is atomically replaced, thus an instance starting meanwhile reads either old or new one.
+ */
+void snapshot_store(int argc, char *argv[], char files[][PATH_MAX + 1], const struct timespec *parse_start, uint64_t parse_ns) {
+    snapshot_hdr_t hdr = {0};
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    strncpy(hdr.version, VERSION, sizeof(hdr.version) - 1);
+    hdr.conf_size = sizeof(conf_t);
+    hdr.argv_hash = argv_hash(argc, argv);
+    hdr.parse_ns = parse_ns;
+    hdr.checksum = fnv1a(0xcbf29ce484222325ULL, &conf, sizeof(conf_t));
+
+    const int64_t start_ns = (int64_t)parse_start->tv_sec * 1000000000 + parse_start->tv_nsec;
+    for (int i = GLOBAL; i <= CUSTOM; i++) {
+        stat_src(&hdr.srcs[i], files[i]);
+        if (hdr.srcs[i].mtime_ns >= start_ns) {
+            DEBUG("%s modified while being parsed. Skipping config snapshot.\n", files[i]);
+            return;
+        }
+    }
+
+    char path[PATH_MAX + 1], tmp_path[PATH_MAX + 1];
+    snapshot_path(path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f) {
+        const bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(&conf, sizeof(conf_t), 1, f) == 1;
+        if (fclose(f) == 0 && ok && rename(tmp_path, path) == 0) {
+            return;
+        }
+        unlink(tmp_path);
+    }
+    DEBUG("Failed to store config snapshot %s.\n", path);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "config.h"
+
+int snapshot_load(int argc, char *argv[], char files[][PATH_MAX + 1], uint64_t *parse_ns);
+void snapshot_store(int argc, char *argv[], char files[][PATH_MAX + 1], const struct timespec *parse_start, uint64_t parse_ns);
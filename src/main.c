@@ -23,10 +23,12 @@
 
 #include <glob.h>
 #include "opts.h"
+#include "monitors.h"
 
 static void init(int argc, char *argv[]);
 static void init_state(void);
 static void sigsegv_handler(int signum);
+static void prefetch_clightd_version(void);
 static void check_clightd_version(void);
 static void init_user_mod_path(enum CONFIG file, char *filename);
 static void load_user_modules(enum CONFIG file);
@@ -39,13 +41,23 @@ void modules_pre_start(void) {
     state.display = getenv("DISPLAY");
     state.wl_display = getenv("WAYLAND_DISPLAY");
     state.xauthority = getenv("XAUTHORITY");
+    
+    /* Prefer Clightd Wayland backends (wlr protocols) to going through XWayland */
+    if (state.wl_display) {
+        state.clightd_display = state.wl_display;
+        state.clightd_env = getenv("XDG_RUNTIME_DIR");
+    } else {
+        state.clightd_display = state.display;
+        state.clightd_env = state.xauthority;
+    }
 } 
 
 int main(int argc, char *argv[]) {
     int ret = setjmp(state.quit_buf);
     if (ret == 0) {
         init(argc, argv);
-        if (conf.bl_conf.disabled && conf.dim_conf.disabled && conf.dpms_conf.disabled && conf.gamma_conf.disabled) {
+        if (conf.bl_conf.disabled && conf.dim_conf.disabled && conf.dpms_conf.disabled && 
+            conf.hook_conf.disabled && conf.gamma_conf.disabled) {
             WARN("No functional module running. Leaving...\n");
         } else {
             state.looping = true;
@@ -54,6 +66,7 @@ int main(int argc, char *argv[]) {
         }
     }
     close_log();
+    destroy_monitors();
     free((void *)state.clightd_version);
     return ret;
 }
@@ -73,8 +86,15 @@ static void init(int argc, char *argv[]) {
     
     /* We want any issue while parsing config to be logged */
     open_log();
+    
+    /* Clightd probes are answered while config is being parsed */
+    prefetch_clightd_version();
+    prefetch_clightd_features();
     init_opts(argc, argv);
+    log_level_set(NULL, conf.verbose ? LOG_LVL_DEBUG : LOG_LVL_INFO);
+    log_set_limits(conf.log_max_size, conf.log_max_files, conf.event_log_size);
     log_conf();
+    open_evlog();
     
     if (!conf.wizard) {
         /* We want any error while checking Clightd required version to be logged AFTER conf logging */
@@ -108,17 +128,24 @@ static void init_state(void) {
 }
 
 /*
- * If received a sigsegv, log a message, destroy lock then
+ * If received a sigsegv, log a message, synchronously flush any pending log
+ * (writer thread may be the faulty one) then
  * set sigsegv signal handler to default (SIG_DFL),
  * and send again the signal to the process.
+ * Log lock is released by the kernel once we die.
  */
 static void sigsegv_handler(int signum) {
     WARN("Received sigsegv signal. Aborting.\n");
-    close_log();
+    log_flush_on_crash();
     signal(signum, SIG_DFL);
     raise(signum);
 }
 
+static void prefetch_clightd_version(void) {
+    SYSBUS_ARG(vers_args, CLIGHTD_SERVICE, "/org/clightd/clightd", "org.clightd.clightd", "Version");
+    get_property_prefetch(&vers_args);
+}
+
 static void check_clightd_version(void) {
     SYSBUS_ARG(vers_args, CLIGHTD_SERVICE, "/org/clightd/clightd", "org.clightd.clightd", "Version");
     
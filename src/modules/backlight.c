@@ -1,24 +1,47 @@
+#include <module/map.h>
 #include "bus.h"
 #include "my_math.h"
+#include "monitors.h"
+#include "notify.h"
 
 enum backlight_pause { UNPAUSED = 0, DISPLAY = 0x01, SENSOR = 0x02, AUTOCALIB = 0x04, LID = 0x08 };
 
+typedef struct {
+    double level;                           // last known backlight level
+} mon_level_t;
+
+/* In-flight Set call on a monitor */
+typedef struct {
+    int ok;
+    char *serial;
+} mon_set_t;
+
 static void receive_waiting_init(const msg_t *const msg, UNUSED const void* userdata);
 static void receive_paused(const msg_t *const msg, const void* userdata);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
 static int is_sensor_available(void);
 static void do_capture(bool reset_timer, bool capture_only);
 static void set_new_backlight(const double perc);
-static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout);
+static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout, const bool is_calib);
+static void init_monitors(void);
+static void on_monitor_level(const char *serial, const double pct);
+static bool follows_global_level(const char *serial);
+static void set_monitors_level(const double pct, const int is_smooth, const double step, const int timeout, const bool is_calib);
+static void set_monitor_level(const char *serial, const mon_conf_t *mon, double pct, int is_smooth, double step, int timeout, const bool is_calib);
+static void on_monitor_set(int r, void *userdata);
 static int capture_frames_brightness(void);
 static void upower_callback(void);
 static void interface_autocalib_callback(bool new_val);
 static void interface_curve_callback(double *regr_points, int num_points, enum ac_states s);
 static void interface_timeout_callback(timeout_upd *up);
+static void interface_phase_timeout_callback(phase_upd *up);
 static void dimmed_callback(void);
 static void time_callback(int old_val, int is_event);
+static void phase_callback(int old_val);
 static int on_sensor_change(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int on_bl_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
+static void start_transition(const double pct, const int is_smooth, const double step, const int timeout);
+static uint64_t now_ms(void);
 static int get_current_timeout(void);
 static void on_lid_update(void);
 static void pause_mod(enum backlight_pause type);
@@ -28,6 +51,7 @@ static int bl_fd = -1;
 static int paused_state;
 static bool paused_fd_recv;
 static sd_bus_slot *sens_slot, *bl_slot;
+static map_t *mon_levels;                   // present monitors serial -> mon_level_t
 
 DECLARE_MSG(bl_msg, BL_UPD);
 DECLARE_MSG(amb_msg, AMBIENT_BR_UPD);
@@ -43,13 +67,19 @@ static void init(void) {
     /* Compute polynomial best-fit parameters for each loaded sensor config */
     interface_curve_callback(NULL, 0, ON_AC);
     interface_curve_callback(NULL, 0, ON_BATTERY);
+    
+    /* Consumed by first is_sensor_available(), once UPOWER and DAYTIME are ready */
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "IsAvailable");
+    call_prefetch(&args, "s", conf.sens_conf.dev_name);
 
     M_SUB(UPOWER_UPD);
     M_SUB(DISPLAY_UPD);
     M_SUB(LID_UPD);
     M_SUB(DAYTIME_UPD);
     M_SUB(IN_EVENT_UPD);
+    M_SUB(DAYPHASE_UPD);
     M_SUB(BL_TO_REQ);
+    M_SUB(BL_PHASE_TO_REQ);
     M_SUB(CAPTURE_REQ);
     M_SUB(CURVE_REQ);
     M_SUB(NO_AUTOCALIB_REQ);
@@ -75,6 +105,10 @@ static void destroy(void) {
     if (bl_fd >= 0) {
         close(bl_fd);
     }
+    if (mon_levels) {
+        map_free(mon_levels);
+        mon_levels = NULL;
+    }
 }
 
 static void receive_waiting_init(const msg_t *const msg, UNUSED const void* userdata) {
@@ -103,6 +137,7 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
         
         SYSBUS_ARG(bl_args, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "Changed");
         add_match(&bl_args, &bl_slot, on_bl_changed);
+        init_monitors();
                 
         bl_fd = start_timer(CLOCK_BOOTTIME, 0, get_current_timeout() > 0);
         m_register_fd(bl_fd, false, NULL);
@@ -118,7 +153,7 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
              *
              * Cannot publish a BL_REQ as BACKLIGHT get paused.
              */
-            set_backlight_level(1.0, false, 0, 0);
+            set_backlight_level(1.0, false, 0, 0, false);
             pause_mod(AUTOCALIB);
         }
         if (state.lid_state) {
@@ -128,6 +163,11 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
              */
             on_lid_update();
         }
+        
+        /* No calibration is going to happen: backlight is already settled */
+        if (paused_state != UNPAUSED) {
+            notify_ready(READY_BACKLIGHT);
+        }
     }
 }
 
@@ -149,6 +189,11 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         time_callback(up->old, MSG_TYPE() == IN_EVENT_UPD);
         break;
     }
+    case DAYPHASE_UPD: {
+        daytime_upd *up = (daytime_upd *)MSG_DATA();
+        phase_callback(up->old);
+        break;
+    }
     case LID_UPD:
         on_lid_update();
         break;
@@ -159,6 +204,13 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         }
         break;
     }
+    case BL_PHASE_TO_REQ: {
+        phase_upd *up = (phase_upd *)MSG_DATA();
+        if (VALIDATE_REQ(up)) {
+            interface_phase_timeout_callback(up);
+        }
+        break;
+    }
     case CAPTURE_REQ: {
         capture_upd *up = (capture_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
@@ -183,7 +235,7 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     case BL_REQ: {
         bl_upd *up = (bl_upd *)MSG_DATA();
         if (VALIDATE_REQ(up)) {
-            set_backlight_level(up->new, up->smooth, up->step, up->timeout);
+            set_backlight_level(up->new, up->smooth, up->step, up->timeout, false);
         }
         break;
     }
@@ -214,6 +266,11 @@ static void receive_paused(const msg_t *const msg, UNUSED const void* userdata)
         time_callback(up->old, MSG_TYPE() == IN_EVENT_UPD);
         break;
     }
+    case DAYPHASE_UPD: {
+        daytime_upd *up = (daytime_upd *)MSG_DATA();
+        phase_callback(up->old);
+        break;
+    }
     case LID_UPD:
         on_lid_update();
         break;
@@ -224,6 +281,13 @@ static void receive_paused(const msg_t *const msg, UNUSED const void* userdata)
         }
         break;
     }
+    case BL_PHASE_TO_REQ: {
+        phase_upd *up = (phase_upd *)MSG_DATA();
+        if (VALIDATE_REQ(up)) {
+            interface_phase_timeout_callback(up);
+        }
+        break;
+    }
     case CAPTURE_REQ: {
         capture_upd *up = (capture_upd *)MSG_DATA();
         /* In paused state check that we're not dimmed/dpms and sensor is available */
@@ -250,7 +314,7 @@ static void receive_paused(const msg_t *const msg, UNUSED const void* userdata)
         /* In paused state check that we're not dimmed/dpms */
         bl_upd *up = (bl_upd *)MSG_DATA();
         if (VALIDATE_REQ(up) && !state.display_state) {
-            set_backlight_level(up->new, up->smooth, up->step, up->timeout);
+            set_backlight_level(up->new, up->smooth, up->step, up->timeout, false);
         }
         break;
     }
@@ -268,8 +332,18 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
         if (r >= 0 && is_avail) {
             DEBUG("Sensor '%s' is now available.\n", sensor);
         }
-    } else if (!strcmp(member, "SetAll")) {
+    } else if (!strcmp(member, "SetAll") || !strcmp(member, "Set")) {
         r = sd_bus_message_read(reply, "b", userdata);
+    } else if (!strcmp(member, "GetAll")) {
+        const char *serial = NULL;
+        double pct;
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(sd)");
+        while (r >= 0 && (r = sd_bus_message_read(reply, "(sd)", &serial, &pct)) > 0) {
+            on_monitor_level(serial, pct);
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(reply);
+        }
     } else if (!strcmp(member, "Capture")) {
         const char *sensor = NULL;
         const double *intensity = NULL;
@@ -283,6 +357,7 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
             DEBUG("Captured [%d/%d] from '%s'. Ambient brightness: %lf.\n", num_captures, 
                   conf.sens_conf.num_captures[state.ac_state], 
                   sensor, state.ambient_br);
+            EVLOG(EVLOG_AMBIENT_BR, state.ambient_br);
             amb_msg.bl.new = state.ambient_br;
             M_PUB(&amb_msg);
         }
@@ -304,9 +379,9 @@ static void do_capture(bool reset_timer, bool capture_only) {
         if (compensated_br >= conf.bl_conf.shutter_threshold) {
             set_new_backlight(compensated_br * (conf.sens_conf.num_points[state.ac_state] - 1));
             if (state.screen_comp > 0.0) {
-                INFO("Ambient brightness: %.3lf (-%.3lf screen compensation) -> Backlight pct: %.3lf.\n", state.ambient_br, state.screen_comp, state.current_bl_pct);
+                INFO("Ambient brightness: %.3lf (-%.3lf screen compensation) -> Backlight pct: %.3lf.\n", state.ambient_br, state.screen_comp, state.bl_trans.target_pct);
             } else {
-                INFO("Ambient brightness: %.3lf -> Backlight pct: %.3lf.\n", state.ambient_br, state.current_bl_pct);
+                INFO("Ambient brightness: %.3lf -> Backlight pct: %.3lf.\n", state.ambient_br, state.bl_trans.target_pct);
             }
         } else if (state.screen_comp > 0.0) {
             INFO("Ambient brightness: %.3lf (-%.3lf screen compensation) -> Clogged capture detected.\n", state.ambient_br, state.screen_comp);
@@ -318,6 +393,9 @@ static void do_capture(bool reset_timer, bool capture_only) {
     if (reset_timer) {
         set_timeout(get_current_timeout(), 0, bl_fd, 0);
     }
+    
+    /* First calibration is done, whatever its outcome */
+    notify_ready(READY_BACKLIGHT);
 }
 
 static void set_new_backlight(const double perc) {
@@ -328,31 +406,159 @@ static void set_new_backlight(const double perc) {
     const double new_br_pct =  clamp(b, 1, 0);
 
     set_backlight_level(new_br_pct, !conf.bl_conf.no_smooth, 
-                        conf.bl_conf.trans_step, conf.bl_conf.trans_timeout);
+                        conf.bl_conf.trans_step, conf.bl_conf.trans_timeout, true);
 }
 
-static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout) {
+/* is_calib: whether level comes from automatic calibration, to apply per-monitor overrides */
+static void set_backlight_level(const double pct, const int is_smooth, const double step, const int timeout, const bool is_calib) {
     int ok = 0;
     SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "SetAll");
     
     /* Set backlight on both internal monitor (in case of laptop) and external ones */
     int r = call(&args, "d(bdu)s", pct, is_smooth, step, timeout, conf.bl_conf.screen_path);
     if (!r && ok) {
-        bl_msg.bl.old = state.current_bl_pct;
-        state.current_bl_pct = pct;
+        bl_msg.bl.old = state.bl_trans.target_pct;
+        start_transition(pct, is_smooth, step, timeout);
+        EVLOG(EVLOG_BL_PCT, pct);
         bl_msg.bl.new = pct;
         bl_msg.bl.smooth = is_smooth;
         bl_msg.bl.step = step;
         bl_msg.bl.timeout = timeout;
         M_PUB(&bl_msg);
+        
+        set_monitors_level(pct, is_smooth, step, timeout, is_calib);
+    }
+}
+
+/*
+ * Track present monitors, to apply their mon.d overrides.
+ * Listed once at startup; then kept updated by Clightd Changed signals:
+ * a monitor never seen before was just plugged,
+ * a monitor that cannot be set anymore was unplugged.
+ */
+static void init_monitors(void) {
+    mon_levels = map_new(true, free);
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "GetAll");
+    call(&args, "s", "");
+}
+
+/* Store last level of a monitor; a monitor never seen before was just plugged */
+static void on_monitor_level(const char *serial, const double pct) {
+    mon_level_t *mon_level = map_get(mon_levels, serial);
+    if (!mon_level) {
+        mon_level = malloc(sizeof(mon_level_t));
+        if (!mon_level) {
+            return;
+        }
+        mon_level->level = pct;
+        map_put(mon_levels, serial, mon_level);
+        
+        const mon_conf_t *mon = get_monitor_conf(serial);
+        if (mon) {
+            INFO("Monitor '%s' found: applying its config.\n", serial);
+            if (state.display_state & DISPLAY_DIMMED) {
+                set_monitor_level(serial, mon, state.bl_trans.target_pct, false, 0, 0, false);
+            }
+        } else {
+            DEBUG("Monitor '%s' found.\n", serial);
+        }
     }
+    mon_level->level = pct;
+}
+
+/*
+ * Overrides never change the level a monitor is set to, only how it gets there (and its dimmed level):
+ * a monitor with overrides only follows global level when it is the only kind present,
+ * eg: a laptop whose internal panel has a mon.d config.
+ */
+static bool follows_global_level(const char *serial) {
+    bool follows = true;
+    if (get_monitor_conf(serial)) {
+        for (map_itr_t *itr = map_itr_new(mon_levels); itr; itr = map_itr_next(itr)) {
+            follows &= get_monitor_conf(map_itr_get_key(itr)) != NULL;
+        }
+    }
+    return follows;
+}
+
+/*
+ * SetAll already moved any monitor to pct:
+ * set again each present monitor that has its own overrides, without waiting for each reply.
+ * As Clightd handles a single transition for each monitor, latest request wins.
+ */
+static void set_monitors_level(const double pct, const int is_smooth, const double step, const int timeout, const bool is_calib) {
+    if (num_monitor_confs() > 0 && mon_levels) {
+        for (map_itr_t *itr = map_itr_new(mon_levels); itr; itr = map_itr_next(itr)) {
+            const char *serial = map_itr_get_key(itr);
+            const mon_conf_t *mon = get_monitor_conf(serial);
+            if (mon) {
+                set_monitor_level(serial, mon, pct, is_smooth, step, timeout, is_calib);
+            }
+        }
+    }
+}
+
+static void set_monitor_level(const char *serial, const mon_conf_t *mon, double pct, int is_smooth, double step, int timeout, const bool is_calib) {
+    const double last = ((mon_level_t *)map_get(mon_levels, serial))->level;
+    if (state.display_state & DISPLAY_DIMMED) {
+        if (mon->dimmed_pct < 0.0) {
+            return;
+        }
+        /* Same as DISPLAY: never raise a monitor to its dimmed level */
+        pct = last < mon->dimmed_pct ? last : mon->dimmed_pct;
+    } else if (is_calib) {
+        const double compensated_br = clamp(state.ambient_br - state.screen_comp, 1, 0);
+        if (compensated_br < mon->shutter_threshold) {
+            /* Clogged capture for this monitor: keep its level */
+            pct = last;
+            is_smooth = false;
+        }
+        if (mon->trans_step > 0.0) {
+            step = mon->trans_step;
+        }
+        if (mon->trans_timeout >= 0) {
+            timeout = mon->trans_timeout;
+        }
+    } else {
+        return;
+    }
+    
+    mon_set_t *set = calloc(1, sizeof(mon_set_t));
+    if (!set || !(set->serial = strdup(serial))) {
+        free(set);
+        return;
+    }
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, &set->ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "Set");
+    if (call_async(&args, on_monitor_set, set, "d(bdu)s", pct, is_smooth, step, timeout, serial) != 0) {
+        DEBUG("Failed to set backlight on monitor '%s'.\n", serial);
+        free(set->serial);
+        free(set);
+    }
+}
+
+/* Clightd does not signal unplugs: a monitor that cannot be set anymore is gone */
+static void on_monitor_set(int r, void *userdata) {
+    mon_set_t *set = (mon_set_t *)userdata;
+    if (r != 0 || !set->ok) {
+        DEBUG("Failed to set backlight on monitor '%s': removed.\n", set->serial);
+        if (mon_levels) {
+            map_remove(mon_levels, set->serial);
+        }
+    }
+    free(set->serial);
+    free(set);
 }
 
 static int capture_frames_brightness(void) {
+    struct timespec start, end;
     SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "Capture");
-    return call(&args, "sis", conf.sens_conf.dev_name, 
-                conf.sens_conf.num_captures[state.ac_state], 
-                conf.sens_conf.dev_opts);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int r = call(&args, "sis", conf.sens_conf.dev_name, 
+                 conf.sens_conf.num_captures[state.ac_state], 
+                 conf.sens_conf.dev_opts);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EVLOG(EVLOG_CAPTURE_LAT, (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+    return r;
 }
 
 /* Callback on upower ac state changed signal */
@@ -391,7 +597,7 @@ static void interface_timeout_callback(timeout_upd *up) {
     if (up->daytime >= DAY && up->daytime <= SIZE_STATES) {
         const int old = get_current_timeout();
         conf.bl_conf.timeout[up->state][up->daytime] = up->new;
-        if (up->state == state.ac_state && 
+        if (up->state == state.ac_state && !conf.bl_conf.has_phase_timeouts[up->state] &&
             (up->daytime == state.day_time || (state.in_event && up->daytime == IN_EVENT))) {
             
             reset_timer(bl_fd, old, get_current_timeout());
@@ -401,6 +607,16 @@ static void interface_timeout_callback(timeout_upd *up) {
     }
 }
 
+/* Callback on phase timeouts requests, eg: from a config reload */
+static void interface_phase_timeout_callback(phase_upd *up) {
+    const int old = get_current_timeout();
+    conf.bl_conf.has_phase_timeouts[up->state] = up->enabled;
+    memcpy(conf.bl_conf.phase_timeout[up->state], up->values, sizeof(up->values));
+    if (up->state == state.ac_state) {
+        reset_timer(bl_fd, old, get_current_timeout());
+    }
+}
+
 /* Callback on state.display_state changes */
 static void dimmed_callback(void) {
     if (state.display_state) {
@@ -412,6 +628,11 @@ static void dimmed_callback(void) {
 
 /* Callback on state.time/state.in_event changes */
 static void time_callback(int old_val, int is_event) {
+    if (conf.bl_conf.has_phase_timeouts[state.ac_state]) {
+        /* Timeouts only depend on twilight phase */
+        return;
+    }
+    
     int old_timeout;
     if (!is_event) {
         /* A state.time change happened, react! */
@@ -426,8 +647,20 @@ static void time_callback(int old_val, int is_event) {
     reset_timer(bl_fd, old_timeout, get_current_timeout());
 }
 
+/* Callback on state.day_phase changes */
+static void phase_callback(int old_val) {
+    if (conf.bl_conf.has_phase_timeouts[state.ac_state]) {
+        reset_timer(bl_fd, conf.bl_conf.phase_timeout[state.ac_state][old_val], get_current_timeout());
+    }
+}
+
 /* Callback on SensorChanged clightd signal */
-static int on_sensor_change(UNUSED sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+static int on_sensor_change(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    if (m) {
+        /* Startup IsAvailable reply, if still unused, predates this change */
+        SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "IsAvailable");
+        drop_prefetch(&args);
+    }
     int new_sensor_avail = is_sensor_available();
     if (new_sensor_avail != state.sens_avail) {
         sens_msg.sens.old = state.sens_avail;
@@ -447,13 +680,51 @@ static int on_sensor_change(UNUSED sd_bus_message *m, UNUSED void *userdata, UNU
 
 static int on_bl_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
     const char *syspath = NULL;
-    sd_bus_message_read(m, "sd", &syspath, &state.current_bl_pct);
-    DEBUG("Backlight level updated: %.2lf.\n", state.current_bl_pct);
+    double pct;
+    if (sd_bus_message_read(m, "sd", &syspath, &pct) >= 0) {
+        on_monitor_level(syspath, pct);
+        if (follows_global_level(syspath)) {
+            state.current_bl_pct = pct;
+            const uint64_t now = now_ms();
+            if (now >= state.bl_trans.eta) {
+                /* No transition running: level was changed by someone else */
+                state.bl_trans = (bl_trans_t){ pct, pct, now, now };
+            } else if (fabs(pct - state.bl_trans.target_pct) < 0.005) {
+                /* Transition reached its target before expected */
+                state.bl_trans.eta = now;
+            }
+        }
+        DEBUG("Backlight level updated: %.2lf.\n", pct);
+    }
     return 0;
 }
 
+/*
+ * Track a new transition from current live level to pct.
+ * Clightd moves backlight by step every timeout ms;
+ * live level is then updated by its Changed signals while transition runs.
+ */
+static void start_transition(const double pct, const int is_smooth, const double step, const int timeout) {
+    const uint64_t now = now_ms();
+    uint64_t duration = 0;
+    if (is_smooth && step > 0.0 && timeout > 0) {
+        duration = (uint64_t)ceil(fabs(pct - state.current_bl_pct) / step) * timeout;
+    } else {
+        state.current_bl_pct = pct;
+    }
+    state.bl_trans = (bl_trans_t){ state.current_bl_pct, pct, now, now + duration };
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
 static inline int get_current_timeout(void) {
+    if (conf.bl_conf.has_phase_timeouts[state.ac_state]) {
+        return conf.bl_conf.phase_timeout[state.ac_state][state.day_phase];
+    }
     if (state.in_event) {
         return conf.bl_conf.timeout[state.ac_state][IN_EVENT];
     }
@@ -11,6 +11,9 @@ enum bus_type { SYSTEM_BUS, USER_BUS };
 /* Bus reply read callback */
 typedef int(*bus_recv_cb)(sd_bus_message *reply, const char *member, void *userdata);
 
+/* call_async() completion callback; r is 0 on success, -1 on error */
+typedef void(*bus_done_cb)(int r, void *userdata);
+
 /*
  * Object wrapper for bus calls
  */
@@ -38,7 +41,12 @@ typedef struct {
 
 
 int call(const bus_args *a, const char *signature, ...);
+int call_prefetch(const bus_args *a, const char *signature, ...);
+int call_async(const bus_args *a, bus_done_cb done, void *userdata, const char *signature, ...);
+int get_property_prefetch(const bus_args *a);
+int drop_prefetch(const bus_args *a);
 int add_match(const bus_args *a, sd_bus_slot **slot, sd_bus_message_handler_t cb);
 int set_property(const bus_args *a, const char *type, const uintptr_t value);
 int get_property(const bus_args *a, const char *type, void *userptr);
 sd_bus *get_user_bus(void);
+bool bus_pending_call(const char **caller, const char **member);
@@ -1,14 +1,42 @@
 #include "my_math.h"
+#include "solar.h"
 #include "timer.h"
 
+/*
+ * Daytime schedule: each slot describes daytime state from its boundary,
+ * ie: state.day_events[anchor] + offset * event_duration, until next slot boundary.
+ * Before first slot boundary, last slot applies.
+ */
+typedef struct {
+    enum day_events anchor;
+    int offset;
+    enum day_states day_time;
+    int in_event;
+    enum day_events next_event;
+    int range;                              // state.event_time_range, in event_duration units
+} daytime_slot_t;
+
 static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userdata);
 static void start_daytime(void);
 static void check_daytime(void);
 static void get_next_events(const time_t *now, const float lat, const float lon, int dayshift);
-static void check_next_event(const time_t *now);
-static void check_state(const time_t *now);
+static void check_schedule(const time_t *now);
+static bool phases_available(void);
+static time_t check_phase(const time_t *now);
 static void reset_daytime(void);
 
+static const daytime_slot_t schedule[] = {
+    { SUNRISE, -1, NIGHT, true,  SUNRISE,  0 },
+    { SUNRISE,  0, DAY,   true,  SUNRISE,  1 },
+    { SUNRISE,  1, DAY,   false, SUNSET,  -1 },
+    { SUNSET,  -1, DAY,   true,  SUNSET,   0 },
+    { SUNSET,   0, NIGHT, true,  SUNSET,   1 },
+    { SUNSET,   1, NIGHT, false, SUNRISE, -1 },
+};
+
+/* Sun elevation at which each phase starts, from PHASE_ASTRONOMICAL to PHASE_DAY */
+static const double phase_elevations[SIZE_PHASES - 1] = { -18.0, -12.0, -6.0, SOLAR_ELEV_HORIZON };
+
 static int gamma_fd;
 
 DECLARE_MSG(time_msg, DAYTIME_UPD);
@@ -16,6 +44,7 @@ DECLARE_MSG(in_ev_msg, IN_EVENT_UPD);
 DECLARE_MSG(sunrise_msg, SUNRISE_UPD);
 DECLARE_MSG(sunset_msg, SUNSET_UPD);
 DECLARE_MSG(next_ev_msg, NEXT_DAYEVT_UPD);
+DECLARE_MSG(phase_msg, DAYPHASE_UPD);
 DECLARE_MSG(temp_req, TEMP_REQ);
 
 MODULE("DAYTIME");
@@ -54,6 +83,7 @@ static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userd
             time_msg.day_time.new = DAY;
             M_PUB(&time_msg);
             state.day_time = DAY;
+            state.day_phase = PHASE_DAY;
         } else {
             start_daytime();
         }
@@ -118,6 +148,7 @@ static void check_daytime(void) {
     const enum day_states old_state = state.day_time;
     const int old_in_event = state.in_event;
     const enum day_events old_next_event = state.next_event; 
+    const enum day_phases old_phase = state.day_phase;
     
     /*
      * get_gamma_events will always poll today events. It should not be necessary,
@@ -127,6 +158,7 @@ static void check_daytime(void) {
      * the wrong day (it should compute "today" events). Thus, avoid this kind of issues.
      */
     get_next_events(&t, state.current_loc.lat, state.current_loc.lon, 0);
+    const time_t next_phase = check_phase(&t);
         
     /** Check which messages should be published **/
     
@@ -155,6 +187,13 @@ static void check_daytime(void) {
         in_ev_msg.day_time.new = state.in_event;
         M_PUB(&in_ev_msg);
     }
+    
+    /* if we switched twilight phase, emit signal */
+    if (old_phase != state.day_phase) {
+        phase_msg.day_time.old = old_phase;
+        phase_msg.day_time.new = state.day_phase;
+        M_PUB(&phase_msg);
+    }
         
     /**                                 **/
     
@@ -170,7 +209,10 @@ static void check_daytime(void) {
         M_PUB(&temp_req);
     }
         
-    const time_t next = state.day_events[state.next_event] + state.event_time_range;
+    time_t next = state.day_events[state.next_event] + state.event_time_range;
+    if (next_phase != -1 && next_phase < next) {
+        next = next_phase;
+    }
     INFO("Next alarm due to: %s", ctime(&next));
     set_timeout(next - t, 0, gamma_fd, 0);
 }
@@ -179,8 +221,8 @@ static void check_daytime(void) {
  * day -> will be 0 first time this func is called, else 1 (tomorrow).
  * Stores day sunrise/sunset events only if this is first time it is called,
  * or of today's sunset event is finished.
- * Firstly computes day's sunrise and sunset; then calls check_next_event and check_state to
- * update next_event and state.time variables according to new state.
+ * Firstly computes day's sunrise and sunset; then calls check_schedule to
+ * update next_event, state.time and state.in_event variables according to new state.
  * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
  * Probably it is just some ms in advance, but rounding it to seconds returns 1s in advance.
  */
@@ -236,50 +278,103 @@ static void get_next_events(const time_t *now, const float lat, const float lon,
         sunset_msg.event.new = state.day_events[SUNSET];
         M_PUB(&sunset_msg);
     }
-    check_next_event(now);
-    check_state(now);
+    check_schedule(now);
 }
 
 /*
- * Updates next_event global var, according to now time_t value.
+ * Walks the daytime schedule to find current slot, ie: last one whose boundary
+ * is already passed, then updates state.day_time, state.in_event, state.next_event
+ * and state.event_time_range accordingly.
+ * Next timer is thus on state.day_events[state.next_event] + state.event_time_range,
+ * ie: next slot boundary.
  * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
  */
-static void check_next_event(const time_t *now) {
-    /*
-     * SUNRISE if:
-     * We're after state.events[SUNSET] (when clight is started between SUNSET)
-     * We're before state.events[SUNRISE] (when clight is started before today's SUNRISE)
-     */
-    if (*now + 1 > state.day_events[SUNSET] || *now + 1 < state.day_events[SUNRISE]) {
-        state.day_time = NIGHT;
-    } else {
-        state.day_time = DAY;
+static void check_schedule(const time_t *now) {
+    const int num_slots = sizeof(schedule) / sizeof(*schedule);
+    const daytime_slot_t *slot = &schedule[num_slots - 1];
+    for (int i = 0; i < num_slots; i++) {
+        const time_t boundary = state.day_events[schedule[i].anchor] + schedule[i].offset * conf.day_conf.event_duration;
+        if (*now + 1 >= boundary) {
+            slot = &schedule[i];
+        }
+    }
+    state.day_time = slot->day_time;
+    state.in_event = slot->in_event;
+    state.next_event = slot->next_event;
+    state.event_time_range = slot->range * conf.day_conf.event_duration;
+    if (state.in_event) {
+        DEBUG("Currently inside an event.\n");
     }
-    state.next_event = (*now + 1 < (state.day_events[SUNRISE] + conf.day_conf.event_duration)) ? SUNRISE : SUNSET;    
 }
 
 /*
- * Updates state.time global var, according to now time_t value.
- * Note that "+1" is because it seems timerfd receives timer end circa 1s in advance.
- * If we're inside an event, checks which side of the events we're in
- * (to understand which conf.temp is correct for this state).
- * Then sets event_time_range accordingly; ie: 30mins before event, if we're not inside an event;
- * 0 if we just entered an event (so next_event has to be exactly event time, to set new temp),
- * 30mins after event to remove EVENT state.
+ * Twilight phases are only meaningful when sunrise/sunset are
+ * computed from a location, not when they are user-set.
  */
-static void check_state(const time_t *now) {
-    if (labs(state.day_events[state.next_event] - (*now + 1)) <= conf.day_conf.event_duration) {
-        if (state.day_events[state.next_event] > *now + 1) {
-            state.event_time_range = 0; // next timer is on next_event
-        } else {
-            state.event_time_range = conf.day_conf.event_duration; // next timer is when leaving event
+static bool phases_available(void) {
+    return state.current_loc.lat != LAT_UNDEFINED && state.current_loc.lon != LON_UNDEFINED &&
+           !strlen(conf.day_conf.day_events[SUNRISE]) && !strlen(conf.day_conf.day_events[SUNSET]);
+}
+
+/*
+ * Updates state.day_phase given sun elevation thresholds in phase_elevations.
+ * For each threshold, computes when sun rises above and sets below it for yesterday, today and tomorrow
+ * (UTC days, so that any longitude is properly covered), through a single solar batch per event.
+ * Current phase is the highest one whose threshold sun is currently above.
+ * Returns time of next phase change, or -1 if phases are not available.
+ */
+static time_t check_phase(const time_t *now) {
+    if (!phases_available()) {
+        state.day_phase = state.day_time == DAY ? PHASE_DAY : PHASE_NIGHT;
+        return -1;
+    }
+    
+    struct tm tm_now;
+    gmtime_r(now, &tm_now);
+    const time_t midnight = *now - (tm_now.tm_hour * 3600 + tm_now.tm_min * 60 + tm_now.tm_sec);
+    const double days[3] = { tm_now.tm_yday - 1, tm_now.tm_yday, tm_now.tm_yday + 1 };
+    /* At least, recheck tomorrow, eg: during polar days/nights */
+    time_t next = midnight + 24 * 60 * 60;
+    
+    state.day_phase = PHASE_NIGHT;
+    for (int p = 0; p < SIZE_PHASES - 1; p++) {
+        double ut[SIZE_EVENTS][3], cos_h[SIZE_EVENTS][3];
+        for (int e = 0; e < SIZE_EVENTS; e++) {
+            solar_batch_t b = { 3, days, ut[e], cos_h[e] };
+            solar_compute_batch(state.current_loc.lat, state.current_loc.lon, e, phase_elevations[p], &b);
+        }
+        
+        for (int d = 0; d < 3; d++) {
+            const time_t base = midnight + (d - 1) * 24 * 60 * 60;
+            time_t rise, set;
+            if (cos_h[SUNRISE][d] < -1.0 || cos_h[SUNSET][d] < -1.0) {
+                /* Sun is above threshold for the whole day */
+                rise = base;
+                set = base + 24 * 60 * 60;
+            } else if (cos_h[SUNRISE][d] > 1.0 || cos_h[SUNSET][d] > 1.0) {
+                /* Sun never reaches threshold */
+                continue;
+            } else {
+                rise = base + ut[SUNRISE][d] * 3600;
+                set = base + ut[SUNSET][d] * 3600;
+                if (set < rise) {
+                    set += 24 * 60 * 60;
+                }
+            }
+            
+            if (*now + 1 >= rise && *now + 1 < set) {
+                state.day_phase = p + 1;
+            }
+            if (rise > *now + 1 && rise < next) {
+                next = rise;
+            }
+            if (set > *now + 1 && set < next) {
+                next = set;
+            }
         }
-        state.in_event = true;
-        DEBUG("Currently inside an event.\n");
-    } else {
-        state.event_time_range = -conf.day_conf.event_duration; // next timer is entering next event
-        state.in_event = false;
     }
+    DEBUG("Current twilight phase: %d.\n", state.day_phase);
+    return next;
 }
 
 static void reset_daytime(void) {
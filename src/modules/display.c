@@ -1,14 +1,45 @@
+#include <module/map.h>
 #include "bus.h"
+#include "monitors.h"
 
+/* Per-output state, as listed by Clightd */
+typedef struct {
+    double level;                           // last known backlight level, or the one we last asked for
+    double old_pct;                         // level before dimming; < 0 if left untouched
+    double restore_pct;                     // level being restored by last undim
+    uint64_t restore_eta;                   // CLOCK_MONOTONIC ms when last undim is expected to end
+    bool listed;                            // whether output was listed by last GetAll
+} display_out_t;
+
+static void enter_dimmed(void);
+static void leave_dimmed(void);
+static int refresh_outputs(void);
+static bool bl_transitioning(void);
+static uint64_t now_ms(void);
+static void set_output_level(const char *serial, const double pct, const bool smooth, const double step, const int to);
 static void publish_bl_req(const double pct, const bool smooth, const double step, const int to);
 static void set_dpms(bool enable);
+static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
+static void batch_begin(const char *what);
+static void on_batch_reply(int r, void *userdata);
 
 DECLARE_MSG(display_msg, DISPLAY_UPD);
 DECLARE_MSG(bl_req, BL_REQ);
 
 MODULE("DISPLAY");
 
+static map_t *outputs;                      // serial -> display_out_t
+static double fallback_pct = -1.0;          // level before dimming, when outputs could not be listed
+
+/* Async calls issued to enter/leave dimmed or dpms state, on all outputs */
+static struct {
+    const char *what;
+    int issued, pending, failed;
+    struct timespec start;
+} batch;
+
 static void init(void) {
+    outputs = map_new(true, free);
     M_SUB(DISPLAY_REQ);
 }
 
@@ -21,8 +52,6 @@ static bool evaluate(void) {
 }
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
-    static double old_pct = -1.0;
-    
     switch (MSG_TYPE()) {
     case DISPLAY_REQ: {
         display_upd *up = (display_upd *)MSG_DATA();
@@ -31,13 +60,7 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
             if (up->new == DISPLAY_DIMMED) {
                 state.display_state |= DISPLAY_DIMMED;
                 DEBUG("Entering dimmed state...\n");
-                if (state.current_bl_pct > conf.dim_conf.dimmed_pct) {
-                    old_pct = state.current_bl_pct;
-                    publish_bl_req(conf.dim_conf.dimmed_pct, !conf.dim_conf.no_smooth[ENTER], 
-                                   conf.dim_conf.trans_step[ENTER], conf.dim_conf.trans_timeout[ENTER]);
-                } else {
-                    DEBUG("A lower than dimmer_pct backlight level is already set. Avoid changing it.\n");
-                }
+                enter_dimmed();
             } else if (up->new == DISPLAY_OFF) {
                 state.display_state |= DISPLAY_OFF;
                 DEBUG("Entering dpms state...\n");
@@ -51,14 +74,11 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
                 if (state.display_state & DISPLAY_DIMMED) {
                     state.display_state &= ~DISPLAY_DIMMED;
                     DEBUG("Leaving dimmed state...\n");
-                    if (old_pct >= 0.0) {
-                        publish_bl_req(old_pct, !conf.dim_conf.no_smooth[EXIT], 
-                                       conf.dim_conf.trans_step[EXIT], conf.dim_conf.trans_timeout[EXIT]);
-                        old_pct = -1.0;
-                    }
+                    leave_dimmed();
                 }
             }
             display_msg.display.new = state.display_state;
+            EVLOG(EVLOG_DISPLAY, state.display_state);
             M_PUB(&display_msg);
         }
         break;
@@ -69,7 +89,123 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
 }
 
 static void destroy(void) {
+    map_free(outputs);
+}
 
+/*
+ * Dim each output to its own dimmed level (mon.d override or global one),
+ * issuing all Set calls at once instead of a single SetAll that Clightd serializes.
+ * Outputs already below their dimmed level are left untouched.
+ * Fallback at a BACKLIGHT request if outputs cannot be listed.
+ */
+static void enter_dimmed(void) {
+    if (refresh_outputs() != 0) {
+        if (state.bl_trans.target_pct > conf.dim_conf.dimmed_pct) {
+            fallback_pct = state.bl_trans.target_pct;
+            publish_bl_req(conf.dim_conf.dimmed_pct, !conf.dim_conf.no_smooth[ENTER], 
+                           conf.dim_conf.trans_step[ENTER], conf.dim_conf.trans_timeout[ENTER]);
+        } else {
+            DEBUG("A lower than dimmer_pct backlight level is already set. Avoid changing it.\n");
+        }
+        return;
+    }
+    
+    batch_begin("Dimming");
+    const uint64_t now = now_ms();
+    for (map_itr_t *itr = map_itr_new(outputs); itr; itr = map_itr_next(itr)) {
+        const char *serial = map_itr_get_key(itr);
+        display_out_t *out = (display_out_t *)map_itr_get_data(itr);
+        const mon_conf_t *mon = get_monitor_conf(serial);
+        const double dimmed_pct = mon && mon->dimmed_pct >= 0.0 ? mon->dimmed_pct : conf.dim_conf.dimmed_pct;
+        /* 
+         * Output may be mid-transition: restore its target, not a stale step;
+         * either our own undim, or BACKLIGHT one for outputs following global level.
+         */
+        double level = out->level;
+        if (now < out->restore_eta) {
+            level = out->restore_pct;
+        } else if (!mon && bl_transitioning()) {
+            level = state.bl_trans.target_pct;
+        }
+        if (level > dimmed_pct) {
+            out->old_pct = level;
+            out->level = dimmed_pct;
+            set_output_level(serial, dimmed_pct, !conf.dim_conf.no_smooth[ENTER], 
+                             conf.dim_conf.trans_step[ENTER], conf.dim_conf.trans_timeout[ENTER]);
+        } else {
+            DEBUG("A lower than dimmer_pct backlight level is already set on '%s'. Avoid changing it.\n", serial);
+        }
+    }
+}
+
+/* Restore each dimmed output to its own previous level */
+static void leave_dimmed(void) {
+    if (fallback_pct >= 0.0) {
+        publish_bl_req(fallback_pct, !conf.dim_conf.no_smooth[EXIT], 
+                       conf.dim_conf.trans_step[EXIT], conf.dim_conf.trans_timeout[EXIT]);
+        fallback_pct = -1.0;
+    }
+    
+    batch_begin("Undimming");
+    const double step = conf.dim_conf.trans_step[EXIT];
+    const int timeout = conf.dim_conf.trans_timeout[EXIT];
+    const bool smooth = !conf.dim_conf.no_smooth[EXIT] && step > 0.0 && timeout > 0;
+    for (map_itr_t *itr = map_itr_new(outputs); itr; itr = map_itr_next(itr)) {
+        display_out_t *out = (display_out_t *)map_itr_get_data(itr);
+        if (out->old_pct >= 0.0) {
+            set_output_level(map_itr_get_key(itr), out->old_pct, !conf.dim_conf.no_smooth[EXIT], step, timeout);
+            /* Clightd moves backlight by step every timeout ms: track when undim will end */
+            out->restore_pct = out->old_pct;
+            out->restore_eta = now_ms() + (smooth ? (uint64_t)ceil(fabs(out->old_pct - out->level) / step) * timeout : 0);
+            out->level = out->old_pct;
+            out->old_pct = -1.0;
+        }
+    }
+}
+
+/* Whether BACKLIGHT transition is still running, ie: outputs levels are not final yet */
+static bool bl_transitioning(void) {
+    return now_ms() < state.bl_trans.eta;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Update outputs table with current level of each output; outputs not listed anymore are unplugged.
+ * Existing entries are kept, not to lose any undim still running on them.
+ */
+static int refresh_outputs(void) {
+    for (map_itr_t *itr = map_itr_new(outputs); itr; itr = map_itr_next(itr)) {
+        ((display_out_t *)map_itr_get_data(itr))->listed = false;
+    }
+    
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "GetAll");
+    int r = call(&args, "s", "");
+    if (r == 0) {
+        for (map_itr_t *itr = map_itr_new(outputs); itr; itr = map_itr_next(itr)) {
+            if (!((display_out_t *)map_itr_get_data(itr))->listed) {
+                map_itr_remove(itr);
+            }
+        }
+        if (map_length(outputs) == 0) {
+            r = -1;
+        }
+    }
+    return r;
+}
+
+static void set_output_level(const char *serial, const double pct, const bool smooth, const double step, const int to) {
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight", "org.clightd.clightd.Backlight", "Set");
+    if (call_async(&args, on_batch_reply, NULL, "d(bdu)s", pct, smooth, step, to, serial) == 0) {
+        batch.issued++;
+        batch.pending++;
+    } else {
+        DEBUG("Failed to set backlight on '%s'.\n", serial);
+    }
 }
 
 static void publish_bl_req(const double pct, const bool smooth, const double step, const int to) {
@@ -81,6 +217,63 @@ static void publish_bl_req(const double pct, const bool smooth, const double ste
 }
 
 static void set_dpms(bool enable) {
+    batch_begin(enable ? "Entering dpms" : "Leaving dpms");
     SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Dpms", "org.clightd.clightd.Dpms", "Set");
-    call(&args, "ssi", state.display, state.xauthority, enable);
+    if (call_async(&args, on_batch_reply, NULL, "ssi", state.clightd_display, state.clightd_env, enable) == 0) {
+        batch.issued++;
+        batch.pending++;
+    }
+}
+
+static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata) {
+    int r = -EINVAL;
+    if (!strcmp(member, "GetAll")) {
+        const char *serial = NULL;
+        double pct;
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(sd)");
+        while (r >= 0 && (r = sd_bus_message_read(reply, "(sd)", &serial, &pct)) > 0) {
+            display_out_t *out = map_get(outputs, serial);
+            if (!out && (out = calloc(1, sizeof(display_out_t)))) {
+                out->old_pct = -1.0;
+                map_put(outputs, serial, out);
+            }
+            if (out) {
+                out->level = pct;
+                out->listed = true;
+            }
+        }
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(reply);
+        }
+    } else if (!strcmp(member, "Set")) {
+        int ok = 0;
+        r = sd_bus_message_read(reply, "b", &ok);
+        if (r >= 0 && !ok) {
+            r = -EIO;
+        }
+    }
+    return r;
+}
+
+/* A new batch only starts once previous one completed: otherwise they are measured together */
+static void batch_begin(const char *what) {
+    batch.what = what;
+    if (batch.pending == 0) {
+        batch.issued = 0;
+        batch.failed = 0;
+        clock_gettime(CLOCK_MONOTONIC, &batch.start);
+    }
+}
+
+static void on_batch_reply(int r, UNUSED void *userdata) {
+    if (r != 0) {
+        batch.failed++;
+    }
+    if (--batch.pending == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const double ms = (now.tv_sec - batch.start.tv_sec) * 1000.0 + (now.tv_nsec - batch.start.tv_nsec) / 1000000.0;
+        DEBUG("%s: %d call(s) completed in %.2lf ms, %d failed.\n", batch.what, batch.issued, ms, batch.failed);
+        EVLOG(EVLOG_DISPLAY_LAT, ms);
+    }
 }
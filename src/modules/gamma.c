@@ -2,33 +2,56 @@
 
 #define GAMMA_LONG_TRANS_TIMEOUT 10         // 10s between each step with slow transitioning
 
+/* Last request issued to an additional output, stored in its state once Clightd replies */
+typedef struct {
+    int ok;
+    int temp;
+    int smooth;
+    int step;
+    int timeout;
+} out_req_t;
+
 static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* userdata);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
+static int gamma_set(const char *display, const char *env, int temp, int smooth, int step, int timeout);
+static bool get_long_transition(const int temps[SIZE_STATES], const time_t *now, int *temp, int *step, int *timeout);
+static int get_ambient_temp(const int temps[SIZE_STATES]);
 static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout);
+static void set_outputs_temp(int daytime, const time_t *now, int smooth, int step, int timeout);
+static void on_output_set(int r, void *userdata);
 static void ambient_callback(void);
 static void on_next_dayevt(evt_upd *up);
 static void on_daytime_req(temp_upd *up);
 static void interface_callback(temp_upd *req);
+static void interface_phase_callback(phase_upd *req);
 
 static bool long_transitioning;
 static const self_t *daytime_ref;
+static out_req_t out_reqs[MAX_GAMMA_OUTPUTS];
+static int out_reqs_pending;                // additional outputs Set calls still waiting for a reply
+static int outs_changed;                    // mask of outputs whose temp changed since last GAMMA_OUT_UPD
 
 DECLARE_MSG(temp_msg, TEMP_UPD);
+DECLARE_MSG(gamma_out_msg, GAMMA_OUT_UPD);
 
 MODULE("GAMMA");
 
 static void init(void) {
+    for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+        state.gamma_outputs[i].display = conf.gamma_conf.outputs[i].display;
+    }
     m_ref("DAYTIME", &daytime_ref);
     M_SUB(BL_UPD);
     M_SUB(TEMP_REQ);
+    M_SUB(PHASE_TEMP_REQ);
     M_SUB(DAYTIME_UPD);
     M_SUB(NEXT_DAYEVT_UPD);
     m_become(waiting_daytime);
 }
 
 static bool check(void) {
-    /* Only on X */
-    return state.display && state.xauthority;
+    /* Only on X or Wayland */
+    return state.clightd_display && state.clightd_env;
 }
 
 static bool evaluate(void) {
@@ -76,6 +99,13 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         }
         break;
     }
+    case PHASE_TEMP_REQ: {
+        phase_upd *up = (phase_upd *)MSG_DATA();
+        if (VALIDATE_REQ(up)) {
+            interface_phase_callback(up);
+        }
+        break;
+    }
     case NEXT_DAYEVT_UPD: {
         evt_upd *up = (evt_upd *)MSG_DATA();
         on_next_dayevt(up);
@@ -90,37 +120,61 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
     return sd_bus_message_read(reply, "b", userdata);
 }
 
-static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout) {
+/* env must match display backend: XDG_RUNTIME_DIR for Wayland, XAUTHORITY for X */
+static int gamma_set(const char *display, const char *env, int temp, int smooth, int step, int timeout) {
     int ok;
     SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
     
-    /* Compute long transition steps and timeouts (if outside of event, fallback to normal transition) */
+    int r = call(&args, "ssi(buu)", display, env, temp, smooth, step, timeout);
+    return -(r || !ok);
+}
+
+/*
+ * Compute long transition target temp, step and timeout for given daytime temperatures.
+ * Returns false if we are outside of an event (ie: fallback to normal transition).
+ */
+static bool get_long_transition(const int temps[SIZE_STATES], const time_t *now, int *temp, int *step, int *timeout) {
     if (conf.gamma_conf.long_transition && now && state.in_event) {
-        smooth = 1;
         if (state.event_time_range == 0) {
             /* Remaining time in first half + second half of transition */
-            timeout = (state.day_events[state.next_event] - *now) + conf.day_conf.event_duration;
-            temp = conf.gamma_conf.temp[!state.day_time]; // use correct temp, ie the one for next event
+            *timeout = (state.day_events[state.next_event] - *now) + conf.day_conf.event_duration;
+            *temp = temps[!state.day_time]; // use correct temp, ie the one for next event
         } else {
             /* Remaining time in second half of transition */
-            timeout = conf.day_conf.event_duration - (*now - state.day_events[state.next_event]);
+            *timeout = conf.day_conf.event_duration - (*now - state.day_events[state.next_event]);
         }
         /* Temperature difference */
-        step = abs(conf.gamma_conf.temp[DAY] - conf.gamma_conf.temp[NIGHT]);
+        *step = abs(temps[DAY] - temps[NIGHT]);
         /* Compute each step size with a gamma_trans_timeout of 10s */
-        step /= (((double)timeout) / GAMMA_LONG_TRANS_TIMEOUT);
+        *step /= (((double)*timeout) / GAMMA_LONG_TRANS_TIMEOUT);
         /* force gamma_trans_timeout to 10s (in ms) */
-        timeout = GAMMA_LONG_TRANS_TIMEOUT * 1000;
-        
-        long_transitioning = true;
-    } else {
-        long_transitioning = false;
+        *timeout = GAMMA_LONG_TRANS_TIMEOUT * 1000;
+        return true;
     }
-        
-    int r = call(&args, "ssi(buu)", state.display, state.xauthority, temp, smooth, step, timeout);    
-    if (!r && ok) {
+    return false;
+}
+
+static int get_ambient_temp(const int temps[SIZE_STATES]) {
+    /* 
+     * Note that temps are not constant (they can be changed through bus api),
+     * thus we have to always compute these ones.
+     */
+    const int diff = abs(temps[DAY] - temps[NIGHT]);
+    const int min_temp = temps[NIGHT] < temps[DAY] ? temps[NIGHT] : temps[DAY]; 
+    return (diff * state.bl_trans.target_pct) + min_temp;
+}
+
+static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout) {
+    /* Compute long transition steps and timeouts (if outside of event, fallback to normal transition) */
+    long_transitioning = get_long_transition(conf.gamma_conf.temp, now, &temp, &step, &timeout);
+    if (long_transitioning) {
+        smooth = 1;
+    }
+    
+    if (gamma_set(state.clightd_display, state.clightd_env, temp, smooth, step, timeout) == 0) {
         temp_msg.temp.old = state.current_temp;
         state.current_temp = temp;
+        EVLOG(EVLOG_TEMP, temp);
         temp_msg.temp.new = state.current_temp;
         temp_msg.temp.smooth = smooth;
         temp_msg.temp.step = step;
@@ -135,19 +189,67 @@ static void set_temp(int temp, const time_t *now, int smooth, int step, int time
     }
 }
 
+/*
+ * Set temperature on every additional output in a single batch, without waiting for each reply,
+ * then publish a single GAMMA_OUT_UPD for all changed outputs once every reply is received.
+ * Each output computes its own target and transition from its own temperatures.
+ * Outputs are X displays: they always go through Clightd X backend with XAUTHORITY,
+ * even when default display goes through Wayland one.
+ * Pass -1 daytime to follow ambient brightness.
+ */
+static void set_outputs_temp(int daytime, const time_t *now, int smooth, int step, int timeout) {
+    for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+        const int *temps = conf.gamma_conf.outputs[i].temp;
+        gamma_out_t *out = &state.gamma_outputs[i];
+        
+        int out_temp = daytime == -1 ? get_ambient_temp(temps) : temps[daytime];
+        int out_smooth = smooth, out_step = step, out_timeout = timeout;
+        out->long_transitioning = get_long_transition(temps, now, &out_temp, &out_step, &out_timeout);
+        if (out->long_transitioning) {
+            out_smooth = 1;
+        }
+        
+        out_req_t *req = &out_reqs[i];
+        *req = (out_req_t){ 0, out_temp, out_smooth, out_step, out_timeout };
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, &req->ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
+        if (call_async(&args, on_output_set, req, "ssi(buu)", out->display, state.xauthority ? state.xauthority : "", 
+                       out_temp, out_smooth, out_step, out_timeout) == 0) {
+            out_reqs_pending++;
+        }
+    }
+}
+
+/* Each output keeps the last request issued to it: a late reply to a previous batch just stores it earlier */
+static void on_output_set(int r, void *userdata) {
+    const out_req_t *req = (out_req_t *)userdata;
+    const int i = req - out_reqs;
+    gamma_out_t *out = &state.gamma_outputs[i];
+    if (r == 0 && req->ok) {
+        if (out->temp != req->temp) {
+            outs_changed |= 1 << i;
+        }
+        out->temp = req->temp;
+        out->smooth = req->smooth;
+        out->step = req->step;
+        out->timeout = req->timeout;
+        DEBUG("%d gamma temp set on '%s' output.\n", req->temp, out->display);
+    } else {
+        DEBUG("Failed to set gamma temp on '%s' output.\n", out->display);
+    }
+    
+    if (--out_reqs_pending == 0 && outs_changed) {
+        gamma_out_msg.gamma_out.changed = outs_changed;
+        outs_changed = 0;
+        M_PUB(&gamma_out_msg);
+    }
+}
+
 static void ambient_callback(void) {
     if (conf.gamma_conf.ambient_gamma) {
-        /* 
-         * Note that conf.temp is not constant (it can be changed through bus api),
-         * thus we have to always compute these ones.
-         */
-        const int diff = abs(conf.gamma_conf.temp[DAY] - conf.gamma_conf.temp[NIGHT]);
-        const int min_temp = conf.gamma_conf.temp[NIGHT] < conf.gamma_conf.temp[DAY] ? 
-                            conf.gamma_conf.temp[NIGHT] : conf.gamma_conf.temp[DAY]; 
-        
-        const int ambient_temp = (diff * state.current_bl_pct) + min_temp;
-        set_temp(ambient_temp, NULL, !conf.gamma_conf.no_smooth, 
+        set_temp(get_ambient_temp(conf.gamma_conf.temp), NULL, !conf.gamma_conf.no_smooth, 
                  conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout); // force refresh (passing NULL time_t*)
+        set_outputs_temp(-1, NULL, !conf.gamma_conf.no_smooth, 
+                         conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
     }
 }
 
@@ -173,6 +275,9 @@ static void on_next_dayevt(evt_upd *up) {
         
         INFO("Long transition ended.\n");
         long_transitioning = false;
+        for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+            state.gamma_outputs[i].long_transitioning = false;
+        }
     }
         
     last_t = t;
@@ -180,17 +285,38 @@ static void on_next_dayevt(evt_upd *up) {
 
 static void on_daytime_req(temp_upd *up) {
     if (!long_transitioning && !conf.gamma_conf.ambient_gamma) {
-        const time_t t = time(NULL);        
-        set_temp(conf.gamma_conf.temp[state.day_time], &t, !conf.gamma_conf.no_smooth, 
-                 conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
+        const time_t t = time(NULL);
+        if (conf.gamma_conf.has_phase_temps) {
+            /* 
+             * DAYTIME wakes us up on each phase change: phase temps are already a staged transition.
+             * Additional outputs only have day/night temps, thus they still switch at sunrise/sunset.
+             */
+            set_temp(conf.gamma_conf.phase_temp[state.day_phase], NULL, !conf.gamma_conf.no_smooth, 
+                     conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
+        } else {
+            set_temp(conf.gamma_conf.temp[state.day_time], &t, !conf.gamma_conf.no_smooth, 
+                     conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
+        }
+        set_outputs_temp(state.day_time, &t, !conf.gamma_conf.no_smooth, 
+                         conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
     }
 }
 
 static void interface_callback(temp_upd *req) {
     if (req->new != conf.gamma_conf.temp[req->daytime]) {
         conf.gamma_conf.temp[req->daytime] = req->new;
-        if (!conf.gamma_conf.ambient_gamma && req->daytime == state.day_time) {
+        if (!conf.gamma_conf.ambient_gamma && !conf.gamma_conf.has_phase_temps && req->daytime == state.day_time) {
             set_temp(req->new, NULL, req->smooth, req->step, req->timeout); // force refresh (passing NULL time_t*)
         }
     }
 }
+
+static void interface_phase_callback(phase_upd *req) {
+    conf.gamma_conf.has_phase_temps = req->enabled;
+    memcpy(conf.gamma_conf.phase_temp, req->values, sizeof(req->values));
+    if (!conf.gamma_conf.ambient_gamma) {
+        const int temp = conf.gamma_conf.has_phase_temps ? conf.gamma_conf.phase_temp[state.day_phase] : conf.gamma_conf.temp[state.day_time];
+        set_temp(temp, NULL, !conf.gamma_conf.no_smooth, 
+                 conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout); // force refresh (passing NULL time_t*)
+    }
+}
@@ -0,0 +1,514 @@
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include "idler.h"
+#include "evidle.h"
+#include "learner.h"
+
+enum idle_stages { STAGE_DIM, STAGE_DPMS, STAGE_HOOK, SIZE_STAGES };
+
+/* A stage is entered once user has been idle for its timeout */
+typedef struct {
+    const char *name;
+    const int *disabled;
+    const int *timeout;                     // timeout for each AC state; <= 0 disables stage in that AC state
+    void (*enter)(void);
+} idle_stage_t;
+
+static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata);
+static void receive_inhibited(const msg_t *const msg, UNUSED const void* userdata);
+static int on_new_idle(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void update_stages(void);
+static int adapted_dim_timeout(void);
+static int stage_timeout(enum idle_stages s);
+static int first_timeout(void);
+static void enter_due_stages(void);
+static void leave_stages(void);
+static void on_user_back(void);
+static void client_set_timeout(void);
+static void client_start(void);
+static void client_stop(void);
+static void client_reset(void);
+static void arm_check(void);
+static void check_activity(void);
+static void on_local_activity(void);
+static void watch_fd(int fd, bool watch);
+static void upower_timeout_callback(void);
+static void timeout_req_callback(int *timeouts, timeout_upd *up);
+static void close_inherited_fds(void);
+static void inhibit_callback(void);
+static void dim_enter(void);
+static void dpms_enter(void);
+static void hook_enter(void);
+
+static const idle_stage_t stages[SIZE_STAGES] = {
+    [STAGE_DIM] = { "dimmer", &conf.dim_conf.disabled, conf.dim_conf.timeout, dim_enter },
+    [STAGE_DPMS] = { "dpms", &conf.dpms_conf.disabled, conf.dpms_conf.timeout, dpms_enter },
+    [STAGE_HOOK] = { "idle hook", &conf.hook_conf.disabled, conf.hook_conf.timeout, hook_enter },
+};
+
+static sd_bus_slot *slot;
+static char client[PATH_MAX + 1];
+static int stage_fd = -1;
+static enum idle_stages order[SIZE_STAGES]; // stages enabled in current AC state, sorted by timeout
+static int num_stages;
+static int entered;                         // mask of stages entered during current idle period
+static bool idle;                           // whether we are in an idle period
+static struct timespec idle_start;          // when user became idle; each stage deadline is computed from it
+static bool local;                          // whether user activity is read from input devices instead of Clightd
+static struct timespec last_activity;       // local backend: last known user activity
+static int dim_timeout;                     // dimmer timeout for current AC state, eventually adapted to user habits
+
+DECLARE_MSG(dimmed_req, DISPLAY_REQ);
+DECLARE_MSG(off_req, DISPLAY_REQ);
+DECLARE_MSG(on_req, DISPLAY_REQ);
+
+MODULE("IDLE");
+
+/*
+ * Single Clightd idle client, whose timeout is the one of first stage;
+ * any following stage is entered through a local timer,
+ * thus stages are always entered in order.
+ * With local backend, first stage is entered through the same timer too.
+ */
+static void init(void) {
+    dimmed_req.display.new = DISPLAY_DIMMED;
+    off_req.display.new = DISPLAY_OFF;
+    on_req.display.new = DISPLAY_ON;
+
+    stage_fd = start_timer(CLOCK_MONOTONIC, 0, 0);
+    m_register_fd(stage_fd, true, NULL);
+
+    if (!conf.local_idle) {
+        idle_prefetch_client();
+    }
+    M_SUB(UPOWER_UPD);
+    M_SUB(INHIBIT_UPD);
+    M_SUB(DIMMER_TO_REQ);
+    M_SUB(DPMS_TO_REQ);
+    M_SUB(SIMULATE_REQ);
+    m_become(waiting_acstate);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.dim_conf.disabled || !conf.dpms_conf.disabled || !conf.hook_conf.disabled;
+}
+
+static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata) {
+    switch (MSG_TYPE()) {
+    case UPOWER_UPD: {
+        update_stages();
+        int r = -1;
+        if (!conf.local_idle) {
+            r = idle_init(client, &slot, first_timeout(), on_new_idle);
+        }
+        if (r != 0 && evidle_init(watch_fd) > 0) {
+            INFO("Reading user activity from input devices.\n");
+            local = true;
+            client_start();
+            r = 0;
+        }
+        if (r != 0) {
+            WARN("Failed to init.\n");
+            m_poisonpill(self());
+        } else {
+            m_unbecome();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        const int fd = msg->fd_msg->fd;
+        if (fd == stage_fd) {
+            read_timer(fd);
+            if (local && !idle) {
+                check_activity();
+            } else {
+                enter_due_stages();
+            }
+        } else if (evidle_is_hotplug(fd)) {
+            evidle_hotplug();
+        } else {
+            on_local_activity();
+        }
+        break;
+    }
+    case UPOWER_UPD:
+        upower_timeout_callback();
+        break;
+    case INHIBIT_UPD:
+        inhibit_callback();
+        break;
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ:
+        timeout_req_callback((MSG_TYPE()) == DIMMER_TO_REQ ? conf.dim_conf.timeout : conf.dpms_conf.timeout, 
+                             (timeout_upd *)MSG_DATA());
+        break;
+    case SIMULATE_REQ: {
+        /* Validation is useless here; only for coherence */
+        if (VALIDATE_REQ((void *)msg->ps_msg->message)) {
+            leave_stages();
+            client_reset();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void receive_inhibited(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+        /* Input devices and stage timer are stopped while inhibited */
+        if (evidle_is_hotplug(msg->fd_msg->fd)) {
+            evidle_hotplug();
+        }
+        break;
+    case UPOWER_UPD:
+        upower_timeout_callback();
+        break;
+    case INHIBIT_UPD:
+        inhibit_callback();
+        break;
+    case DIMMER_TO_REQ:
+    case DPMS_TO_REQ:
+        timeout_req_callback((MSG_TYPE()) == DIMMER_TO_REQ ? conf.dim_conf.timeout : conf.dpms_conf.timeout, 
+                             (timeout_upd *)MSG_DATA());
+        break;
+    default:
+        /* SIMULATE_REQ is not handled while inhibited */
+        break;
+    }
+}
+
+static void destroy(void) {
+    if (local) {
+        evidle_destroy();
+    } else {
+        idle_client_destroy(client);
+    }
+    if (slot) {
+        slot = sd_bus_slot_unref(slot);
+    }
+    if (stage_fd >= 0) {
+        close(stage_fd);
+    }
+}
+
+static int on_new_idle(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int is_idle;
+    sd_bus_message_read(m, "b", &is_idle);
+    if (is_idle && !idle && num_stages) {
+        /* Client fires once user has been idle for first timeout */
+        clock_gettime(CLOCK_MONOTONIC, &idle_start);
+        idle_start.tv_sec -= first_timeout();
+        idle = true;
+        enter_due_stages();
+    } else if (!is_idle) {
+        on_user_back();
+    }
+    return 0;
+}
+
+/* Sort stages enabled in current AC state by timeout; same timeouts keep dim -> dpms -> hook order */
+static void update_stages(void) {
+    dim_timeout = adapted_dim_timeout();
+    num_stages = 0;
+    for (int i = STAGE_DIM; i < SIZE_STAGES; i++) {
+        if (!*stages[i].disabled && stage_timeout(i) > 0) {
+            int j = num_stages++;
+            for (; j > 0 && stage_timeout(order[j - 1]) > stage_timeout(i); j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+        }
+    }
+}
+
+/* When learning, dimmer timeout is adapted to current hour of week; it never gets past dpms one */
+static int adapted_dim_timeout(void) {
+    int timeout = conf.dim_conf.timeout[state.ac_state];
+    if (conf.dim_conf.learn && !conf.dim_conf.disabled) {
+        timeout = learn_dim_timeout(timeout);
+        const int dpms_timeout = conf.dpms_conf.timeout[state.ac_state];
+        if (!conf.dpms_conf.disabled && dpms_timeout > 0 && timeout >= dpms_timeout) {
+            timeout = dpms_timeout - 1;
+        }
+        if (timeout != dim_timeout) {
+            DEBUG("Dimmer timeout: %d s (configured: %d s).\n", timeout, conf.dim_conf.timeout[state.ac_state]);
+        }
+    }
+    return timeout;
+}
+
+static inline int stage_timeout(enum idle_stages s) {
+    if (s == STAGE_DIM) {
+        return dim_timeout;
+    }
+    return stages[s].timeout[state.ac_state];
+}
+
+/*
+ * Idle time after which an idle period starts; 0 if no stage is enabled.
+ * That is first stage timeout; when learning, idle periods must be sampled
+ * from shortest adapted dimmer timeout, whatever current one is, not to skew learned habits.
+ */
+static inline int first_timeout(void) {
+    if (!num_stages) {
+        return 0;
+    }
+    int timeout = stage_timeout(order[0]);
+    const int dim_conf_timeout = conf.dim_conf.timeout[state.ac_state];
+    if (conf.dim_conf.learn && !conf.dim_conf.disabled && dim_conf_timeout > 0) {
+        const int min_timeout = learn_min_timeout(dim_conf_timeout);
+        if (min_timeout < timeout) {
+            timeout = min_timeout;
+        }
+    }
+    return timeout;
+}
+
+/* Enter any stage whose deadline elapsed, then arm stage timer on next deadline */
+static void enter_due_stages(void) {
+    if (!idle) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < num_stages; i++) {
+        const enum idle_stages s = order[i];
+        if (entered & (1 << s)) {
+            continue;
+        }
+        const time_t deadline = idle_start.tv_sec + stage_timeout(s);
+        if (deadline > now.tv_sec || (deadline == now.tv_sec && idle_start.tv_nsec > now.tv_nsec)) {
+            set_timeout(deadline, idle_start.tv_nsec, stage_fd, TFD_TIMER_ABSTIME);
+            return;
+        }
+        DEBUG("Entering %s stage.\n", stages[s].name);
+        entered |= 1 << s;
+        stages[s].enter();
+    }
+}
+
+/* User is back: undo any display stage */
+static void leave_stages(void) {
+    if (entered & ((1 << STAGE_DIM) | (1 << STAGE_DPMS))) {
+        /* Unused in requests! */
+        on_req.display.old = state.display_state;
+        M_PUB(&on_req);
+    }
+    if (idle) {
+        set_timeout(0, 0, stage_fd, 0);
+    }
+    entered = 0;
+    idle = false;
+}
+
+/* 
+ * User activity ended idle period: learn how long user was idle, whether screen got dimmed or not,
+ * then apply any new adapted dimmer timeout.
+ * Time is measured from configured timeout, as measuring it from the adapted one
+ * would feed the adaptation back into its own samples.
+ */
+static void on_user_back(void) {
+    const bool was_idle = idle;
+    leave_stages();
+    if (was_idle && conf.dim_conf.learn && !conf.dim_conf.disabled && conf.dim_conf.timeout[state.ac_state] > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const double idle_time = (now.tv_sec - idle_start.tv_sec) + (now.tv_nsec - idle_start.tv_nsec) / 1000000000.0;
+        learn_record(time(NULL) - (time_t)idle_time, idle_time - conf.dim_conf.timeout[state.ac_state]);
+        
+        const int old_timeout = first_timeout();
+        update_stages();
+        if (first_timeout() != old_timeout) {
+            client_set_timeout();
+        }
+    }
+}
+
+/* Reset client timeout to new first stage, and move next stage deadline */
+static void upower_timeout_callback(void) {
+    update_stages();
+    client_set_timeout();
+    enter_due_stages();
+}
+
+static void client_set_timeout(void) {
+    if (!local) {
+        idle_set_timeout(client, first_timeout());
+    } else if (!idle && !state.inhibited) {
+        arm_check();
+    }
+}
+
+/* User activity is not tracked while stopped: consider user active when restarting */
+static void client_start(void) {
+    if (!local) {
+        idle_client_start(client, first_timeout());
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &last_activity);
+        arm_check();
+    }
+}
+
+static void client_stop(void) {
+    if (!local) {
+        idle_client_stop(client);
+    } else {
+        evidle_watch(false);
+        set_timeout(0, 0, stage_fd, 0);
+    }
+}
+
+static void client_reset(void) {
+    if (!local) {
+        idle_client_reset(client, first_timeout());
+    } else {
+        evidle_watch(false);
+        client_start();
+    }
+}
+
+/* Local backend: check user activity when first stage would be due */
+static void arm_check(void) {
+    if (first_timeout() > 0) {
+        set_timeout(last_activity.tv_sec + first_timeout(), last_activity.tv_nsec, stage_fd, TFD_TIMER_ABSTIME);
+    } else {
+        set_timeout(0, 0, stage_fd, 0);
+    }
+}
+
+/*
+ * Local backend: input devices are only read now, 
+ * as their events timestamps tell when user was last active.
+ * If still active, check again when first stage would be due since then;
+ * else, start idle period, waiting for first activity on input devices.
+ */
+static void check_activity(void) {
+    struct timespec now;
+    evidle_last_activity(&last_activity);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    const time_t deadline = last_activity.tv_sec + first_timeout();
+    if (first_timeout() > 0 && (now.tv_sec > deadline || (now.tv_sec == deadline && now.tv_nsec >= last_activity.tv_nsec))) {
+        idle_start = last_activity;
+        idle = true;
+        evidle_watch(true);
+        enter_due_stages();
+    } else {
+        arm_check();
+    }
+}
+
+static void watch_fd(int fd, bool watch) {
+    if (watch) {
+        m_register_fd(fd, false, NULL);
+    } else {
+        m_deregister_fd(fd);
+    }
+}
+
+/* Local backend: first input event while idle */
+static void on_local_activity(void) {
+    if (evidle_last_activity(&last_activity)) {
+        evidle_watch(false);
+        on_user_back();
+        arm_check();
+    }
+}
+
+/*
+ * If we're getting inhibited, stop idle client and end current idle period,
+ * undoing any display stage, as user activity is not tracked meanwhile.
+ * Else, restart client.
+ */
+static void inhibit_callback(void) {
+    if (!state.inhibited) {
+        DEBUG("Being resumed.\n");
+        client_start();
+        m_unbecome();
+    } else {
+        DEBUG("Being paused.\n");
+        client_stop();
+        leave_stages();
+        m_become(inhibited);
+    }
+}
+
+static void dim_enter(void) {
+    /* Unused in requests! */
+    dimmed_req.display.old = state.display_state;
+    M_PUB(&dimmed_req);
+}
+
+static void dpms_enter(void) {
+    /* Unused in requests! */
+    off_req.display.old = state.display_state;
+    M_PUB(&off_req);
+}
+
+/* Update a stage timeout for an AC state, as requested through bus api */
+static void timeout_req_callback(int *timeouts, timeout_upd *up) {
+    if (VALIDATE_REQ(up)) {
+        timeouts[up->state] = up->new;
+        if (up->state == state.ac_state) {
+            upower_timeout_callback();
+        }
+    }
+}
+
+/*
+ * Hook command must not inherit any of our fds (bus sockets, input devices, log files...),
+ * not all of them being CLOEXEC.
+ * Called in forked child: only use async-signal-safe calls.
+ */
+static void close_inherited_fds(void) {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 3, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    const long max_fd = sysconf(_SC_OPEN_MAX);
+    for (int fd = 3; fd < (max_fd > 0 ? max_fd : 1024); fd++) {
+        close(fd);
+    }
+}
+
+/*
+ * Run idle hook command (eg: to lock the session), without waiting for it.
+ * Double fork, so that it is reparented and never left as a zombie.
+ */
+static void hook_enter(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (fork() == 0) {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigprocmask(SIG_SETMASK, &mask, NULL);
+            setsid();
+            close_inherited_fds();
+            execl("/bin/sh", "sh", "-c", conf.hook_conf.command, (char *)NULL);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    if (pid == -1) {
+        WARN("Failed to run idle hook: %s\n", strerror(errno));
+    } else {
+        waitpid(pid, NULL, 0);
+    }
+}
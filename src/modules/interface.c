@@ -1,6 +1,7 @@
 #include <module/map.h>
 #include "bus.h"
 #include "config.h"
+#include "notify.h"
 
 #define VALIDATE_PARAMS(m, signature, ...) \
     int r = sd_bus_message_read(m, signature, __VA_ARGS__); \
@@ -15,17 +16,27 @@
 typedef struct {
     int cookie;
     int refs;
+    const char *key;                        // owner: bus sender or CLIGHT_INH_KEY
     const char *app;
     const char *reason;
+    char cookie_key[16];                    // key in cookie_map
 } lock_t;
 
 /** org.freedesktop.ScreenSaver spec implementation **/
 static void lock_dtor(void *data);
 static int start_inhibit_monitor(void);
+static int open_inhibit_monitor(void);
+static void stop_inhibit_monitor(void);
 static void inhibit_parse_msg(sd_bus_message *m);
+static void on_monitored_inhibit(sd_bus_message *m);
+static void on_monitored_uninhibit(sd_bus_message *m);
+static int on_sc_name_owner(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static int on_bus_name_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static int create_inhibit(int *cookie, const char *key, const char *app_name, const char *reason);
 static int drop_inhibit(int *cookie, const char *key, bool force);
+static int new_cookie(char *cookie_key);
+static int append_inhibitor(void *reply, const char *key, void *data);
+static int method_list_inhibitors(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_clight_changebl(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
@@ -56,10 +67,19 @@ static int set_event(sd_bus *bus, const char *path, const char *interface, const
 static int set_screen_contrib(sd_bus *bus, const char *path, const char *interface, const char *property,
                               sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int get_log_level(sd_bus *bus, const char *path, const char *interface, const char *property,
+                         sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int set_log_level(sd_bus *bus, const char *path, const char *interface, const char *property,
+                         sd_bus_message *value, void *userdata, sd_bus_error *error);
+static int get_module_log_levels(sd_bus *bus, const char *path, const char *interface, const char *property,
+                                 sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int method_set_module_log_level(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void gamma_out_path_for(int idx, char *path);
 
 static const char object_path[] = "/org/clight/clight";
 static const char bus_interface[] = "org.clight.clight";
 static const char sc_interface[] = "org.freedesktop.ScreenSaver";
+static const char gamma_out_interface[] = "org.clight.clight.Gamma.Output";
 
 /* Names should match _UPD topic names here as a signal is emitted on each topic */
 static const sd_bus_vtable clight_vtable[] = {
@@ -70,6 +90,7 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_PROPERTY("Sunset", "t", NULL, offsetof(state_t, day_events[SUNSET]), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("NextEvent", "i", NULL, offsetof(state_t, next_event), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("DayTime", "i", NULL, offsetof(state_t, day_time), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("DayPhase", "i", NULL, offsetof(state_t, day_phase), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("InEvent", "b", NULL, offsetof(state_t, in_event), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("DisplayState", "i", NULL, offsetof(state_t, display_state), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("AcState", "i", NULL, offsetof(state_t, ac_state), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
@@ -85,6 +106,7 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_PROPERTY("ScreenComp", "d", NULL, offsetof(state_t, screen_comp), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_METHOD("Capture", "bb", NULL, method_capture, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Inhibit", "b", NULL, method_clight_inhibit, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("ListInhibitors", NULL, "a(sssu)", method_list_inhibitors, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("IncBl", "d", NULL, method_clight_changebl, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("DecBl", "d", NULL, method_clight_changebl, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Load", "s", NULL, method_load, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -94,7 +116,9 @@ static const sd_bus_vtable clight_vtable[] = {
 
 static const sd_bus_vtable conf_vtable[] = {
     SD_BUS_VTABLE_START(0),
-    SD_BUS_WRITABLE_PROPERTY("Verbose", "b", NULL, NULL, offsetof(conf_t, verbose), 0),
+    SD_BUS_WRITABLE_PROPERTY("LogLevel", "i", get_log_level, set_log_level, 0, 0),
+    SD_BUS_PROPERTY("ModuleLogLevels", "a{si}", get_module_log_levels, 0, 0),
+    SD_BUS_METHOD("SetModuleLogLevel", "si", NULL, method_set_module_log_level, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Store", NULL, NULL, method_store_conf, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
@@ -132,6 +156,9 @@ static const sd_bus_vtable conf_kbd_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_WRITABLE_PROPERTY("Dim", "b", NULL, NULL, offsetof(kbd_conf_t, dim), 0),
     SD_BUS_WRITABLE_PROPERTY("AmbBrThresh", "d", NULL, NULL, offsetof(kbd_conf_t, amb_br_thres), 0),
+    SD_BUS_WRITABLE_PROPERTY("NoSmooth", "b", NULL, NULL, offsetof(kbd_conf_t, no_smooth), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransStep", "d", NULL, NULL, offsetof(kbd_conf_t, trans_step), 0),
+    SD_BUS_WRITABLE_PROPERTY("TransDuration", "i", NULL, NULL, offsetof(kbd_conf_t, trans_timeout), 0),
     SD_BUS_VTABLE_END
 };
 
@@ -147,6 +174,17 @@ static const sd_bus_vtable conf_gamma_vtable[] = {
     SD_BUS_VTABLE_END
 };
 
+static const sd_bus_vtable gamma_out_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_PROPERTY("Display", "s", NULL, offsetof(gamma_out_t, display), SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("Temp", "i", NULL, offsetof(gamma_out_t, temp), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("Smooth", "b", NULL, offsetof(gamma_out_t, smooth), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("Step", "i", NULL, offsetof(gamma_out_t, step), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("Timeout", "i", NULL, offsetof(gamma_out_t, timeout), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("LongTransition", "b", NULL, offsetof(gamma_out_t, long_transitioning), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_VTABLE_END
+};
+
 static const sd_bus_vtable conf_daytime_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_WRITABLE_PROPERTY("Sunrise", "s", NULL, set_event, offsetof(daytime_conf_t, day_events[SUNRISE]), 0),
@@ -180,6 +218,7 @@ static const sd_bus_vtable conf_dpms_vtable[] = {
 static const sd_bus_vtable conf_screen_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_PROPERTY("NumSamples", "i", NULL, offsetof(screen_conf_t, samples), SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_PROPERTY("EmaAlpha", "d", NULL, offsetof(screen_conf_t, ema_alpha), SD_BUS_VTABLE_PROPERTY_CONST),
     SD_BUS_WRITABLE_PROPERTY("Contrib", "d", NULL, set_screen_contrib, offsetof(screen_conf_t, contrib), 0),
     SD_BUS_WRITABLE_PROPERTY("AcTimeout", "i", NULL, set_timeouts, offsetof(screen_conf_t, timeout[ON_AC]), 0),
     SD_BUS_WRITABLE_PROPERTY("BattTimeout", "i", NULL, set_timeouts, offsetof(screen_conf_t, timeout[ON_BATTERY]), 0),
@@ -218,8 +257,12 @@ DECLARE_MSG(sunrise_req, SUNRISE_REQ);
 DECLARE_MSG(sunset_req, SUNSET_REQ);
 DECLARE_MSG(simulate_req, SIMULATE_REQ);
 
-static map_t *lock_map;
+static map_t *lock_map;                     // sender -> lock_t, owns locks
+static map_t *cookie_map;                   // cookie -> lock_t, to drop locks from any sender
+static uint32_t last_cookie;
 static sd_bus *userbus, *monbus;
+static int mon_fd = -1;
+static sd_bus_slot *sc_name_slots[2];      // NameAcquired and NameLost matches
 static sd_bus_message *curve_message; // this is used to keep curve points data lingering around in set_curve
 static sd_bus_slot *lock_slot;
 
@@ -303,6 +346,18 @@ static void init(void) {
                                     conf_gamma_interface,
                                     conf_gamma_vtable,
                                     &conf.gamma_conf);
+        
+        /* Gamma/Output<i> interfaces, one for each configured output */
+        for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+            char gamma_out_path[PATH_MAX + 1];
+            gamma_out_path_for(i, gamma_out_path);
+            r += sd_bus_add_object_vtable(userbus,
+                                        NULL,
+                                        gamma_out_path,
+                                        gamma_out_interface,
+                                        gamma_out_vtable,
+                                        &state.gamma_outputs[i]);
+        }
     }
     
     r += sd_bus_add_object_vtable(userbus,
@@ -385,19 +440,34 @@ static void init(void) {
             
             /** org.freedesktop.ScreenSaver API **/
             if (!conf.inh_conf.disabled) {
-                if (sd_bus_request_name(userbus, sc_interface, SD_BUS_NAME_REPLACE_EXISTING) < 0) {
-                    WARN("Failed to create %s dbus interface: %s\n", sc_interface, strerror(-r));
-                    INFO("Fallback at monitoring requests to %s name owner.\n", sc_interface);
-                    if (start_inhibit_monitor() != 0) {
-                        WARN("Failed to register %s inhibition monitor.\n", sc_interface);
+                lock_map = map_new(true, lock_dtor);
+                cookie_map = map_new(false, NULL);
+                
+                /* 
+                 * Queue for the name: monitor requests to its current owner only while we do not own it,
+                 * and stop monitoring as soon as we acquire it.
+                 */
+                USERBUS_ARG(acq_args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameAcquired");
+                add_match(&acq_args, &sc_name_slots[0], on_sc_name_owner);
+                USERBUS_ARG(lost_args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameLost");
+                add_match(&lost_args, &sc_name_slots[1], on_sc_name_owner);
+                
+                const int sc_r = sd_bus_request_name(userbus, sc_interface, SD_BUS_NAME_REPLACE_EXISTING | SD_BUS_NAME_QUEUE);
+                if (sc_r <= 0) {
+                    if (sc_r < 0) {
+                        WARN("Failed to create %s dbus interface: %s\n", sc_interface, strerror(-sc_r));
                     }
+                    INFO("Fallback at monitoring requests to %s name owner.\n", sc_interface);
+                    start_inhibit_monitor();
                 }
-                lock_map = map_new(true, lock_dtor);
             }
             /**                                 **/
         }
     }
     
+    /* Bus names are owned (or we failed to own them): do not hold back readiness */
+    notify_ready(READY_INTERFACE);
+    
     if (r < 0) {
         WARN("Failed to init.\n");
         m_poisonpill(self());
@@ -429,6 +499,21 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     }
     case SYSTEM_UPD:
         break;
+    case GAMMA_OUT_UPD: {
+        gamma_out_upd *up = (gamma_out_upd *)MSG_DATA();
+        if (userbus) {
+            for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+                if (up->changed & (1 << i)) {
+                    char gamma_out_path[PATH_MAX + 1];
+                    gamma_out_path_for(i, gamma_out_path);
+                    DEBUG("Emitting %s Temp property\n", gamma_out_path);
+                    sd_bus_emit_properties_changed(userbus, gamma_out_path, gamma_out_interface, "Temp", 
+                                                   "Smooth", "Step", "Timeout", "LongTransition", NULL);
+                }
+            }
+        }
+        break;
+    }
     default:
         if (userbus) {
             DEBUG("Emitting %s property\n", msg->ps_msg->topic);
@@ -449,12 +534,17 @@ static void destroy(void) {
     if (monbus) {
         monbus = sd_bus_flush_close_unref(monbus);
     }
+    for (int i = 0; i < 2; i++) {
+        sc_name_slots[i] = sd_bus_slot_unref(sc_name_slots[i]);
+    }
+    map_free(cookie_map);
     map_free(lock_map);
     curve_message = sd_bus_message_unref(curve_message);
 }
 
 static void lock_dtor(void *data) {
     lock_t *l = (lock_t *)data;
+    free((void *)l->key);
     free((void *)l->app);
     free((void *)l->reason);
     free(l);
@@ -462,13 +552,42 @@ static void lock_dtor(void *data) {
 
 /** org.freedesktop.ScreenSaver spec implementation: https://people.freedesktop.org/~hadess/idle-inhibition-spec/re01.html **/
 
+/* 
+ * Monitored ScreenSaver methods: match rules only let through calls to these ones,
+ * then they are dispatched by member.
+ */
+static const struct {
+    const char *member;
+    const char *signature;
+    void (*handler)(sd_bus_message *m);
+} monitor_handlers[] = {
+    { "Inhibit", "ss", on_monitored_inhibit },
+    { "UnInhibit", "u", on_monitored_uninhibit },
+};
+
+#define MONITOR_RULE(member) "type='method_call',destination='org.freedesktop.ScreenSaver',interface='org.freedesktop.ScreenSaver',member='" member "'"
+static const char *monitor_rules[] = { MONITOR_RULE("Inhibit"), MONITOR_RULE("UnInhibit") };
+
 /* 
  * Fallback to monitoring org.freedesktop.ScreenSaver bus name to receive Inhibit/UnhInhibit notifications
  * when org.freedesktop.ScreenSaver name could not be owned by Clight (ie: there is some other app that is owning it).
+ * Monitor connection is only created then, and dropped once we acquire the name.
  * 
  * Stolen from: https://github.com/systemd/systemd/blob/master/src/busctl/busctl.c#L1203 (busctl monitor)
  */
 static int start_inhibit_monitor(void) {
+    if (monbus) {
+        return 0;
+    }
+    int r = open_inhibit_monitor();
+    if (r != 0) {
+        WARN("Failed to register %s inhibition monitor.\n", sc_interface);
+        monbus = sd_bus_flush_close_unref(monbus);
+    }
+    return r;
+}
+
+static int open_inhibit_monitor(void) {
     int r = sd_bus_new(&monbus);
     if (r < 0) {
         WARN("Failed to create monitor: %m\n");
@@ -515,49 +634,68 @@ static int start_inhibit_monitor(void) {
     USERBUS_ARG(args, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus.Monitoring", "BecomeMonitor");
     args.bus = monbus;
     
-    r = call(&args, "asu", 1, "destination='org.freedesktop.ScreenSaver'", 0);
+    r = call(&args, "asu", 2, monitor_rules[0], monitor_rules[1], 0);
     if (r == 0) {
         sd_bus_process(monbus, NULL);
-        int fd = sd_bus_get_fd(monbus);
-        m_register_fd(dup(fd), true, monbus);
+        mon_fd = dup(sd_bus_get_fd(monbus));
+        m_register_fd(mon_fd, true, monbus);
     }
     return r;
 }
 
+static void stop_inhibit_monitor(void) {
+    if (monbus) {
+        m_deregister_fd(mon_fd);
+        mon_fd = -1;
+        monbus = sd_bus_flush_close_unref(monbus);
+        INFO("Stopped monitoring requests to %s name owner.\n", sc_interface);
+    }
+}
+
 static void inhibit_parse_msg(sd_bus_message *m) {
-    if (sd_bus_message_get_member(m)) {
-        const char *member = sd_bus_message_get_member(m);
-        const char *signature = sd_bus_message_get_signature(m, false);
-        const char *interface = sd_bus_message_get_interface(m);
-        
-        for (int i = 1; i <= 2; i++) {
-            if (!strcmp(interface, sc_interface)
-                && !strcmp(member, sc_vtable[i].x.method.member)
-                && !strcmp(signature, sc_vtable[i].x.method.signature)) {
-                
-                switch (i) {
-                case 1: { // Inhibit!!
-                    int cookie = 0;
-                    char *app_name = NULL, *reason = NULL;
-                    int r = sd_bus_message_read(m, "ss", &app_name, &reason); 
-                    if (r < 0) {
-                        WARN("Failed to parse parameters: %s\n", strerror(-r));
-                    } else {
-                        create_inhibit(&cookie, sd_bus_message_get_sender(m), app_name, reason);
-                    }
-                    break;
-                }
-                case 2: // UnInhibit!!
-                    drop_inhibit(NULL, sd_bus_message_get_sender(m), false);
-                    break;
-                default:
-                    break;
+    const char *member = sd_bus_message_get_member(m);
+    if (member) {
+        for (size_t i = 0; i < sizeof(monitor_handlers) / sizeof(*monitor_handlers); i++) {
+            if (!strcmp(member, monitor_handlers[i].member)) {
+                if (!strcmp(sd_bus_message_get_signature(m, true), monitor_handlers[i].signature)) {
+                    monitor_handlers[i].handler(m);
                 }
+                break;
             }
         }
     }
 }
 
+static void on_monitored_inhibit(sd_bus_message *m) {
+    int cookie = 0;
+    char *app_name = NULL, *reason = NULL;
+    int r = sd_bus_message_read(m, "ss", &app_name, &reason); 
+    if (r < 0) {
+        WARN("Failed to parse parameters: %s\n", strerror(-r));
+    } else {
+        create_inhibit(&cookie, sd_bus_message_get_sender(m), app_name, reason);
+    }
+}
+
+/* Cookie was handed out by name owner, not by us: drop sender lock */
+static void on_monitored_uninhibit(sd_bus_message *m) {
+    drop_inhibit(NULL, sd_bus_message_get_sender(m), false);
+}
+
+/* NameAcquired/NameLost signals for org.freedesktop.ScreenSaver queued name request */
+static int on_sc_name_owner(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    const char *name = NULL;
+    if (sd_bus_message_read(m, "s", &name) >= 0 && !strcmp(name, sc_interface)) {
+        if (!strcmp(sd_bus_message_get_member(m), "NameAcquired")) {
+            stop_inhibit_monitor();
+        } else {
+            INFO("Lost %s name. Fallback at monitoring requests to its new owner.\n", sc_interface);
+            start_inhibit_monitor();
+        }
+    }
+    return 0;
+}
+
 /*
  * org.freedesktop.ScreenSaver spec:
  * Inhibition will stop when the UnInhibit function is called, 
@@ -581,16 +719,20 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
         l->refs++;
         *cookie = l->cookie;
     } else {
-        lock_t *l = malloc(sizeof(lock_t));
+        lock_t *l = calloc(1, sizeof(lock_t));
         if (l) {
             if (*cookie != CLIGHT_COOKIE) {
-                *cookie = random();
+                *cookie = new_cookie(l->cookie_key);
+            } else {
+                snprintf(l->cookie_key, sizeof(l->cookie_key), "%u", (uint32_t)*cookie);
             }
             l->cookie = *cookie;
             l->refs = 1;
+            l->key = strdup(key);
             l->app = strdup(app_name);
             l->reason = strdup(reason);
-            map_put(lock_map, key, l);
+            map_put(lock_map, l->key, l);
+            map_put(cookie_map, l->cookie_key, l);
             
             DEBUG("New ScreenSaver inhibition held by '%s': '%s'. Cookie: %d.\n", l->app, l->reason, l->cookie);
 
@@ -611,18 +753,17 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
     return 0;
 }
 
+/*
+ * Lookup sender lock first; when a cookie is given and sender holds no lock with it,
+ * lookup cookie_map, as UnInhibit may come from another sender than Inhibit one.
+ * Monitored UnInhibit calls pass no cookie, as theirs are not ours.
+ */
 static int drop_inhibit(int *cookie, const char *key, bool force) {
     lock_t *l = map_get(lock_map, key);
-    if (!l && cookie) {
-        /* May be another sender is asking to drop a cookie? Linear search */
-        for (map_itr_t *itr = map_itr_new(lock_map); itr; itr = map_itr_next(itr)) {
-            lock_t *tmp = (lock_t *)map_itr_get_data(itr);
-            if (tmp->cookie == *cookie) {
-                l = tmp;
-                free(itr);
-                itr = NULL;
-            }
-        }
+    if (cookie && (!l || l->cookie != *cookie)) {
+        char cookie_key[16];
+        snprintf(cookie_key, sizeof(cookie_key), "%u", (uint32_t)*cookie);
+        l = map_get(cookie_map, cookie_key);
     }
 
     if (l) {
@@ -635,10 +776,12 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
             DEBUG("Dropped ScreenSaver inhibition held by '%s': '%s'. Cookie: %d.\n", l->app, l->reason, l->cookie);
             inhibit_req.inhibit.old = state.inhibited;
             inhibit_req.inhibit.new = false;
-            inhibit_req.inhibit.force = !strcmp(key, CLIGHT_INH_KEY); // forcefully disable inhibition for Clight INTERFACE Inhibit "false"
+            inhibit_req.inhibit.force = !strcmp(l->key, CLIGHT_INH_KEY); // forcefully disable inhibition for Clight INTERFACE Inhibit "false"
             M_PUB(&inhibit_req);
 
-            map_remove(lock_map, key);
+            /* lock_map owns the lock: remove it last */
+            map_remove(cookie_map, l->cookie_key);
+            map_remove(lock_map, l->key);
             if (map_length(lock_map) == 0) {
                 /* Stop listening on NameOwnerChanged signals */
                 lock_slot = sd_bus_slot_unref(lock_slot);
@@ -649,6 +792,21 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
     return -1;
 }
 
+/*
+ * Cookies are handed out sequentially, skipping 0, CLIGHT_COOKIE and any cookie still in use
+ * after wrapping around, thus they never collide.
+ */
+static int new_cookie(char *cookie_key) {
+    do {
+        last_cookie++;
+        if (last_cookie == 0 || last_cookie == (uint32_t)CLIGHT_COOKIE) {
+            last_cookie = 1;
+        }
+        snprintf(cookie_key, 16, "%u", last_cookie);
+    } while (map_has_key(cookie_map, cookie_key));
+    return last_cookie;
+}
+
 static int method_clight_inhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     int inhibit;
     VALIDATE_PARAMS(m, "b", &inhibit);
@@ -680,12 +838,12 @@ static int method_clight_changebl(sd_bus_message *m, void *userdata, sd_bus_erro
         bl_req.bl.smooth = -1;
         
         if (!strcmp(sd_bus_message_get_member(m), "IncBl")) {
-            bl_req.bl.new = state.current_bl_pct + change_pct;
+            bl_req.bl.new = state.bl_trans.target_pct + change_pct;
             if (bl_req.bl.new > 1.0) {
                 bl_req.bl.new = 1.0;
             }
         } else {
-            bl_req.bl.new = state.current_bl_pct - change_pct;
+            bl_req.bl.new = state.bl_trans.target_pct - change_pct;
             if (bl_req.bl.new < 0.0) {
                 bl_req.bl.new = 0.0;
             }
@@ -722,6 +880,36 @@ static int method_uninhibit(sd_bus_message *m, void *userdata, sd_bus_error *ret
     return -EINVAL;
 }
 
+static int append_inhibitor(void *reply, const char *key, void *data) {
+    lock_t *l = (lock_t *)data;
+    const int r = sd_bus_message_append(reply, "(sssu)", key, l->app, l->reason, l->cookie);
+    /* Non-zero return stops the iteration */
+    return r < 0 ? r : 0;
+}
+
+/* Reply with all inhibition holders: owner, app name, reason and cookie */
+static int method_list_inhibitors(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_message_new_method_return(m, &reply);
+    if (r >= 0) {
+        r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(sssu)");
+    }
+    if (r >= 0 && lock_map) {
+        r = map_iterate(lock_map, append_inhibitor, reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    if (r < 0) {
+        sd_bus_error_set_errno(ret_error, -r);
+    }
+    return r;
+}
+
 static int method_simulate_activity(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     M_PUB(&simulate_req);
     return sd_bus_reply_method_return(m, NULL);
@@ -928,3 +1116,51 @@ static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *re
     }
     return r;
 }
+
+static int get_log_level(sd_bus *bus, const char *path, const char *interface, const char *property,
+                         sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    return sd_bus_message_append(reply, "i", log_level_get(NULL));
+}
+
+static int set_log_level(sd_bus *bus, const char *path, const char *interface, const char *property,
+                         sd_bus_message *value, void *userdata, sd_bus_error *error) {
+    int level;
+    VALIDATE_PARAMS(value, "i", &level);
+    
+    r = log_level_set(NULL, level);
+    if (r < 0) {
+        sd_bus_error_set_errno(error, -r);
+    }
+    return r;
+}
+
+static int get_module_log_levels(sd_bus *bus, const char *path, const char *interface, const char *property,
+                                 sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    int r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "{si}");
+    const char *mod;
+    for (int i = 0; (mod = log_module_name(i)) && r >= 0; i++) {
+        r = sd_bus_message_append(reply, "{si}", mod, log_level_get(mod));
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    return r;
+}
+
+static int method_set_module_log_level(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *module;
+    int level;
+    
+    VALIDATE_PARAMS(m, "si", &module, &level);
+    r = log_level_set(module, level);
+    if (r < 0) {
+        sd_bus_error_set_errno(ret_error, -r);
+        return r;
+    }
+    INFO("'%s' log level set to %d.\n", module, level);
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static void gamma_out_path_for(int idx, char *path) {
+    snprintf(path, PATH_MAX, "%s/Gamma/Output%d", object_path, idx);
+}
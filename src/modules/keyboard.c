@@ -1,7 +1,13 @@
+#include <sys/timerfd.h>
 #include "bus.h"
+#include "my_math.h"
 
 static int init_kbd_backlight(void);
-static void set_keyboard_level(const double amb_br);
+static void set_keyboard_ambient(const double amb_br);
+static void set_keyboard_level(const double level, const int is_smooth, const double step, const int timeout);
+static void step_keyboard_level(void);
+static int set_kbd_backlight(const int level);
+static int on_kbd_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static void dimmed_callback(void);
 
 DECLARE_MSG(kbd_msg, KBD_BL_UPD);
@@ -9,20 +15,20 @@ DECLARE_MSG(kbd_msg, KBD_BL_UPD);
 MODULE("KEYBOARD");
 
 static int max_kbd_backlight;
+static int kbd_fd = -1;                     // smooth transitions timer
+static int cur_level = -1;                  // last level successfully set through UPower; -1 if unknown
+static int target_level;                    // level we are transitioning to
+static double target_pct;                   // target_level as requested pct
+static int step_levels, step_timeout;       // current transition step (levels) and timeout (ms)
+static double fit_parameters[DEGREE];       // best-fit parameters of fitted_points curve
+static double fitted_points[MAX_SIZE_POINTS];
+static int fitted_num_points;
+static sd_bus_slot *kbd_slot;
 
+/* Reply is only awaited on LOOP_STARTED, letting other modules' probes run meanwhile */
 static void init(void) {
-    if (init_kbd_backlight() == 0 && max_kbd_backlight > 0) {
-        M_SUB(DISPLAY_UPD);
-        M_SUB(AMBIENT_BR_UPD);
-        M_SUB(KBD_BL_REQ);
-        
-        /* Switch off keyboard from start as BACKLIGHT sets 100% backlight */
-        if (!conf.bl_conf.disabled && conf.bl_conf.no_auto_calib) {
-            set_keyboard_level(1.0);
-        }
-    } else {
-        m_poisonpill(self());
-    }
+    SYSBUS_ARG(kbd_args, "org.freedesktop.UPower", "/org/freedesktop/UPower/KbdBacklight", "org.freedesktop.UPower.KbdBacklight", "GetMaxBrightness");
+    call_prefetch(&kbd_args, NULL);
 }
 
 static bool check(void) {
@@ -35,16 +41,48 @@ static bool evaluate() {
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
+    case SYSTEM_UPD:
+        if (msg->ps_msg->type == LOOP_STARTED) {
+            if (init_kbd_backlight() == 0 && max_kbd_backlight > 0) {
+                M_SUB(DISPLAY_UPD);
+                M_SUB(AMBIENT_BR_UPD);
+                M_SUB(KBD_BL_REQ);
+                
+                kbd_fd = start_timer(CLOCK_MONOTONIC, 0, 0);
+                m_register_fd(kbd_fd, true, NULL);
+                
+                SYSBUS_ARG(args, "org.freedesktop.UPower", "/org/freedesktop/UPower/KbdBacklight", "org.freedesktop.UPower.KbdBacklight", "BrightnessChanged");
+                add_match(&args, &kbd_slot, on_kbd_changed);
+                
+                /* Switch off keyboard from start as BACKLIGHT sets 100% backlight */
+                if (!conf.bl_conf.disabled && conf.bl_conf.no_auto_calib) {
+                    set_keyboard_level(0.0, false, 0, 0);
+                }
+            } else {
+                m_poisonpill(self());
+            }
+        }
+        break;
+    case FD_UPD:
+        read_timer(msg->fd_msg->fd);
+        step_keyboard_level();
+        break;
     case DISPLAY_UPD:
         dimmed_callback();
         break;
     case AMBIENT_BR_UPD:
-        set_keyboard_level(state.ambient_br);
+        set_keyboard_ambient(state.ambient_br);
         break;
     case KBD_BL_REQ: {
         bl_upd *up = (bl_upd *)MSG_DATA();
+        /* Validation fills BACKLIGHT conf values: use keyboard ones instead */
+        const bool use_conf = up->smooth == -1;
         if (VALIDATE_REQ(up) && !state.display_state) {
-            set_keyboard_level(up->new);
+            if (use_conf) {
+                set_keyboard_level(up->new, !conf.kbd_conf.no_smooth, conf.kbd_conf.trans_step, conf.kbd_conf.trans_timeout);
+            } else {
+                set_keyboard_level(up->new, up->smooth, up->step, up->timeout);
+            }
         }
         break;
     }
@@ -54,7 +92,12 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
 }
 
 static void destroy(void) {
-    
+    if (kbd_fd >= 0) {
+        close(kbd_fd);
+    }
+    if (kbd_slot) {
+        kbd_slot = sd_bus_slot_unref(kbd_slot);
+    }
 }
 
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata) {    
@@ -72,24 +115,106 @@ static int init_kbd_backlight(void) {
     return r;
 }
 
-static void set_keyboard_level(const double amb_br) {
-    double level = (conf.kbd_conf.amb_br_thres - amb_br) / conf.kbd_conf.amb_br_thres;
-    if (level < 0) {
-        level = 0;
+/*
+ * Map ambient brightness, normalized by amb_br_thres, on keyboard backlight curve;
+ * keyboard is switched off above amb_br_thres.
+ * Curve is only fitted again when its points change (ie: on config reload).
+ */
+static void set_keyboard_ambient(const double amb_br) {
+    double level = 0.0;
+    if (amb_br < conf.kbd_conf.amb_br_thres) {
+        if (fitted_num_points != conf.kbd_conf.num_points || 
+            memcmp(fitted_points, conf.kbd_conf.regression_points, sizeof(fitted_points))) {
+            
+            polynomialfit(NULL, conf.kbd_conf.regression_points, fit_parameters, conf.kbd_conf.num_points);
+            memcpy(fitted_points, conf.kbd_conf.regression_points, sizeof(fitted_points));
+            fitted_num_points = conf.kbd_conf.num_points;
+        }
+        
+        /* y = a0 + a1x + a2x^2 */
+        const double x = clamp(amb_br / conf.kbd_conf.amb_br_thres, 1, 0) * (conf.kbd_conf.num_points - 1);
+        level = clamp(fit_parameters[0] + fit_parameters[1] * x + fit_parameters[2] * pow(x, 2), 1, 0);
     }
+    set_keyboard_level(level, !conf.kbd_conf.no_smooth, conf.kbd_conf.trans_step, conf.kbd_conf.trans_timeout);
+}
+
+/*
+ * Keyboards only expose a few integer levels:
+ * skip any request that would not change current level (this drops any ongoing transition too),
+ * so that most captures cause no UPower call at all.
+ * Smooth transitions move by (at least) one level each timeout ms.
+ */
+static void set_keyboard_level(const double level, const int is_smooth, const double step, const int timeout) {
+    const int new_level = round(level * max_kbd_backlight);
+    set_timeout(0, 0, kbd_fd, 0);
     
-    SYSBUS_ARG(kbd_args, "org.freedesktop.UPower", "/org/freedesktop/UPower/KbdBacklight", "org.freedesktop.UPower.KbdBacklight", "SetBrightness");
-        
-    kbd_msg.bl.old = state.current_kbd_pct;
-    /* We actually need to pass an int to variadic bus() call */
-    const int new_kbd_br = round(level * max_kbd_backlight);
-    if (call(&kbd_args, NULL, "i", new_kbd_br) == 0) {
-        state.current_kbd_pct = level;
+    target_level = new_level;
+    target_pct = level;
+    if (new_level == cur_level) {
+        DEBUG("Keyboard backlight already at level %d.\n", new_level);
+        return;
+    }
+    
+    if (is_smooth && cur_level != -1 && timeout > 0) {
+        step_levels = fmax(1, round(step * max_kbd_backlight));
+        step_timeout = timeout;
+    } else {
+        /* Single step */
+        step_levels = max_kbd_backlight;
+        step_timeout = 0;
+    }
+    step_keyboard_level();
+}
+
+static void step_keyboard_level(void) {
+    int next = target_level;
+    if (cur_level != -1) {
+        if (next > cur_level + step_levels) {
+            next = cur_level + step_levels;
+        } else if (next < cur_level - step_levels) {
+            next = cur_level - step_levels;
+        }
+    }
+    
+    if (set_kbd_backlight(next) != 0) {
+        return;
+    }
+    
+    if (cur_level != target_level) {
+        set_timeout(step_timeout / 1000, (step_timeout % 1000) * 1000 * 1000, kbd_fd, 0);
+    } else {
+        kbd_msg.bl.old = state.current_kbd_pct;
+        state.current_kbd_pct = target_pct;
+        EVLOG(EVLOG_KBD_PCT, target_pct);
         kbd_msg.bl.new = state.current_kbd_pct;
         M_PUB(&kbd_msg);
     }
 }
 
+static int set_kbd_backlight(const int level) {
+    SYSBUS_ARG(kbd_args, "org.freedesktop.UPower", "/org/freedesktop/UPower/KbdBacklight", "org.freedesktop.UPower.KbdBacklight", "SetBrightness");
+    
+    /* We actually need to pass an int to variadic bus() call */
+    int r = call(&kbd_args, NULL, "i", level);
+    if (r == 0) {
+        cur_level = level;
+    }
+    return r;
+}
+
+/*
+ * Keep cur_level in sync when keyboard backlight is changed by someone else (eg: a hotkey),
+ * otherwise a following request to our last level would be wrongly skipped.
+ */
+static int on_kbd_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error) {
+    int level;
+    if (sd_bus_message_read(m, "i", &level) >= 0 && level != cur_level) {
+        DEBUG("Keyboard backlight level changed to %d.\n", level);
+        cur_level = level;
+    }
+    return 0;
+}
+
 /* Callback on state.display_state changes */
 static void dimmed_callback(void) {
     static double old_kbd_level = 0.0;
@@ -98,12 +223,12 @@ static void dimmed_callback(void) {
         /* Switch off keyboard if requested */
         if (conf.kbd_conf.dim) {
             old_kbd_level = state.current_kbd_pct;
-            set_keyboard_level(0.0);
+            set_keyboard_level(0.0, false, 0, 0);
         }
     } else {
         /* Reset keyboard backlight level if needed */
         if (old_kbd_level != 0.0) {
-            set_keyboard_level(old_kbd_level);
+            set_keyboard_level(old_kbd_level, !conf.kbd_conf.no_smooth, conf.kbd_conf.trans_step, conf.kbd_conf.trans_timeout);
             old_kbd_level = 0.0;
         }
     }
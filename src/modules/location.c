@@ -21,6 +21,10 @@ DECLARE_MSG(loc_req, LOCATION_REQ);
 MODULE("LOCATION");
 
 static void init(void) {
+    /* Consumed by geoclue_get_client() on LOOP_STARTED */
+    SYSBUS_ARG(args, "org.freedesktop.GeoClue2", "/org/freedesktop/GeoClue2/Manager", "org.freedesktop.GeoClue2.Manager", "GetClient");
+    call_prefetch(&args, NULL);
+    
     init_cache_file();
     M_SUB(LOCATION_REQ);
 }
@@ -43,6 +47,11 @@ static bool evaluate(void) {
  * Stop geoclue2 client and store latest location to cache.
  */
 static void destroy(void) {
+    if (!strlen(client)) {
+        /* Release client created by an unused GetClient prefetch */
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, "org.freedesktop.GeoClue2", "/org/freedesktop/GeoClue2/Manager", "org.freedesktop.GeoClue2.Manager", "GetClient");
+        drop_prefetch(&args);
+    }
     if (strlen(client)) {
         geoclue_client_delete();
     }
@@ -1,5 +1,7 @@
 #include "bus.h"
-#include "my_math.h"
+#include "ring.h"
+#include "damage.h"
+#include "sampler.h"
 
 enum screen_pause { UNPAUSED = 0, DISPLAY = 0x01, SENSOR = 0x02, LID = 0x04, CONTRIB = 0x08 };
 
@@ -8,19 +10,24 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
 static void get_screen_brightness(bool compute);
 static void receive_computing(const msg_t *msg, const void *userdata);
 static void timeout_callback(int old_val, bool is_computing);
+static void on_timer(bool compute);
+static void on_damage(void);
 static void pause_screen(bool pause, enum screen_pause type);
 
 MODULE("SCREEN");
 
-static double *screen_br;
-static int screen_ctr, screen_fd = -1;
+static ring_t screen_br;
+static int screen_fd = -1, damage_fd = -1;
 static int paused_state;
+static bool damaged = true;                 // whether screen content changed since last sample
+static bool local_sampler;                  // whether in-process sampler is used
+static time_t last_sample;
+static time_t damaged_at;                   // first screen content change since last sample; 0 while sampling on fixed timeout
 
 DECLARE_MSG(screen_msg, SCR_BL_UPD);
 
 static void init(void) {
-    screen_br = calloc(conf.screen_conf.samples, sizeof(double));
-    if (screen_br) {
+    if (ring_init(&screen_br, conf.screen_conf.samples, conf.screen_conf.ema_alpha) == 0) {
         M_SUB(CONTRIB_REQ);
         M_SUB(SCR_TO_REQ);
         M_SUB(UPOWER_UPD);
@@ -36,8 +43,8 @@ static void init(void) {
 }
 
 static bool check(void) {
-    /* Only on X */
-    return state.display && state.xauthority;
+    /* Only on X or Wayland */
+    return state.clightd_display && state.clightd_env;
 }
 
 static bool evaluate(void) {
@@ -47,10 +54,12 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
-    free(screen_br);
+    ring_destroy(&screen_br);
     if (screen_fd >= 0) {
         close(screen_fd);
     }
+    damage_destroy();
+    sampler_destroy();
 }
 
 static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdata) {
@@ -59,6 +68,22 @@ static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdat
         /* Start paused if screen timeout for current ac state is <= 0 */
         screen_fd = start_timer(CLOCK_BOOTTIME, 0, conf.screen_conf.timeout[state.ac_state] > 0);
         m_register_fd(screen_fd, false, NULL);
+        /* Sample only on screen content changes, if supported (X only: XWayland root window does not see Wayland clients) */
+        if (conf.screen_conf.damage_debounce > 0 && !state.wl_display) {
+            damage_fd = damage_init();
+            if (damage_fd >= 0) {
+                DEBUG("Sampling on screen content changes.\n");
+                m_register_fd(damage_fd, false, NULL);
+            } else {
+                DEBUG("Screen content changes not available. Sampling on fixed timeout.\n");
+            }
+        }
+        if (conf.screen_conf.local_sampling) {
+            local_sampler = sampler_init() == 0;
+            if (!local_sampler) {
+                INFO("In-process sampling not available. Fallback at Clightd.\n");
+            }
+        }
         m_unbecome();
         break;
     }
@@ -70,8 +95,12 @@ static void receive_waiting_acstate(const msg_t *msg, UNUSED const void *userdat
 static void receive(const msg_t *msg, UNUSED const void *userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD:
-        read_timer(msg->fd_msg->fd);
-        get_screen_brightness(false);
+        if (msg->fd_msg->fd == damage_fd) {
+            on_damage();
+        } else {
+            read_timer(msg->fd_msg->fd);
+            on_timer(false);
+        }
         break;
     case UPOWER_UPD: {
         upower_upd *up = (upower_upd *)MSG_DATA();
@@ -115,8 +144,12 @@ static void receive(const msg_t *msg, UNUSED const void *userdata) {
 static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD:
-        read_timer(msg->fd_msg->fd);
-        get_screen_brightness(true);
+        if (msg->fd_msg->fd == damage_fd) {
+            on_damage();
+        } else {
+            read_timer(msg->fd_msg->fd);
+            on_timer(true);
+        }
         break;
     case UPOWER_UPD: {
         upower_upd *up = (upower_upd *)MSG_DATA();
@@ -152,7 +185,7 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
             conf.screen_conf.contrib = up->new;
             /* Recompute current screen compensation */
             screen_msg.bl.old = state.screen_comp;
-            state.screen_comp = compute_average(screen_br, conf.screen_conf.samples) * conf.screen_conf.contrib;
+            state.screen_comp = ring_mean(&screen_br) * conf.screen_conf.contrib;
             if (screen_msg.bl.old != state.screen_comp) {
                 screen_msg.bl.new = state.screen_comp;
                 M_PUB(&screen_msg);
@@ -172,32 +205,106 @@ static void receive_computing(const msg_t *msg, UNUSED const void *userdata) {
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata) {
     int r = -EINVAL;
     if (!strcmp(member, "GetEmittedBrightness")) {
-        r = sd_bus_message_read(reply, "d", &screen_br[screen_ctr]);
+        r = sd_bus_message_read(reply, "d", userdata);
     }
     return r;
 }
 
 static void get_screen_brightness(bool compute) {
-    SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
+    double br;
+    int r;
+    if (local_sampler) {
+        r = sampler_get_brightness(&br);
+        if (r == -ENOTCONN) {
+            INFO("In-process sampling not available anymore. Fallback at Clightd.\n");
+            sampler_destroy();
+            local_sampler = false;
+        }
+    }
+    if (!local_sampler) {
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, &br, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
+        r = call(&args, "ss", state.clightd_display, state.clightd_env);
+    }
     
-    if (call(&args, "ss", state.display, state.xauthority) == 0) {
-        screen_ctr = (screen_ctr + 1) % conf.screen_conf.samples;
+    if (r == 0) {
+        ring_push(&screen_br, br);
         
         if (compute) {
             screen_msg.bl.old = state.screen_comp;
-            state.screen_comp = compute_average(screen_br, conf.screen_conf.samples) * conf.screen_conf.contrib;
+            state.screen_comp = ring_mean(&screen_br) * conf.screen_conf.contrib;
             if (screen_msg.bl.old != state.screen_comp) {
                 screen_msg.bl.new = state.screen_comp;
+                EVLOG(EVLOG_SCREEN_COMP, state.screen_comp);
                 M_PUB(&screen_msg);
             }
             DEBUG("Average screen-emitted brightness: %lf.\n", state.screen_comp);
-        } else if (screen_ctr + 1 == conf.screen_conf.samples) {
+        } else if (ring_full(&screen_br)) {
             /* Bucket filled! Start computing! */
             DEBUG("Start compensating for screen-emitted brightness.\n");
             m_become(computing);
         }
     }
-    set_timeout(conf.screen_conf.timeout[state.ac_state], 0, screen_fd, 0);
+    
+    if (damage_fd >= 0 && compute) {
+        /* Bucket is filled: wait for next screen content change */
+        last_sample = time(NULL);
+        damaged = false;
+        set_timeout(0, 0, screen_fd, 0);
+    } else {
+        damaged_at = 0;
+        set_timeout(conf.screen_conf.timeout[state.ac_state], 0, screen_fd, 0);
+    }
+}
+
+static void on_timer(bool compute) {
+    /* A static screen costs no captures */
+    if (damaged) {
+        get_screen_brightness(compute);
+    }
+}
+
+/*
+ * Screen content changed: (re)schedule a sample damage_debounce ms after last change,
+ * so that a burst of changes costs a single sample.
+ * Sample is never taken sooner than screen timeout since last sample,
+ * nor later than screen timeout since first change, for a screen that never stops changing.
+ * If X connection is lost, fallback at fixed timeout.
+ */
+static void on_damage(void) {
+    const int r = damage_drain();
+    if (r < 0) {
+        INFO("Screen content changes not available anymore. Sampling on fixed timeout.\n");
+        m_deregister_fd(damage_fd);
+        damage_destroy();
+        damage_fd = -1;
+        damaged = true;
+        damaged_at = 0;
+        set_timeout(conf.screen_conf.timeout[state.ac_state], 0, screen_fd, 0);
+        return;
+    }
+    
+    const time_t now = time(NULL);
+    if (r > 0 && !damaged) {
+        damaged = true;
+        damaged_at = now;
+    }
+    const int timeout = conf.screen_conf.timeout[state.ac_state];
+    if (r > 0 && damaged_at && timeout > 0) {
+        long wait = conf.screen_conf.damage_debounce;
+        const long earliest = (last_sample + timeout - now) * 1000;
+        const long latest = (damaged_at + timeout - now) * 1000;
+        if (wait < earliest) {
+            wait = earliest;
+        }
+        if (wait > latest) {
+            wait = latest;
+        }
+        /* A zeroed timeout would disarm the timer */
+        if (wait <= 0) {
+            wait = 1;
+        }
+        set_timeout(wait / 1000, (wait % 1000) * 1000000, screen_fd, 0);
+    }
 }
 
 static void timeout_callback(int old_val, bool is_computing) {
@@ -210,8 +317,7 @@ static void timeout_callback(int old_val, bool is_computing) {
      */
     if (conf.screen_conf.timeout[state.ac_state] <= 0) {
         state.screen_comp = 0.0;
-        memset(screen_br, 0, conf.screen_conf.samples * sizeof(double));
-        screen_ctr = 0;
+        ring_reset(&screen_br);
         
         if (is_computing) {
             m_unbecome();
@@ -1,11 +1,23 @@
 #include <sys/signalfd.h>
+#include <sys/inotify.h>
 #include <signal.h>
-#include "commons.h"
+#include "opts.h"
+#include "reload.h"
+
+static void watch_conf_files(void);
+static bool is_conf_event(const struct inotify_event *ev);
+static void reload(void);
+static void publish_req(const message_t *req);
+
+static int sig_fd = -1;
+static int inot_fd = -1;
+static int watches[CUSTOM + 1] = { [0 ... CUSTOM] = -1 };   // watched dir for each config file
 
 MODULE("SIGNAL");
 
 /*
- * Set signals handler for SIGINT and SIGTERM (using a signalfd)
+ * Set signals handler for SIGINT, SIGTERM and SIGHUP (using a signalfd),
+ * and watch config files for changes.
  */
 static void init(void) {
     sigset_t mask;
@@ -13,10 +25,15 @@ static void init(void) {
     sigemptyset(&mask);
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
     sigprocmask(SIG_BLOCK, &mask, NULL);
 
-    int fd = signalfd(-1, &mask, 0);
-    m_register_fd(fd, true, NULL);
+    sig_fd = signalfd(-1, &mask, 0);
+    m_register_fd(sig_fd, true, NULL);
+
+    if (!conf.wizard) {
+        watch_conf_files();
+    }
 }
 
 static bool check(void) {
@@ -32,13 +49,93 @@ static void destroy(void) {
     /* Skeleton function needed for modules interface */
 }
 
+/*
+ * Watch directories instead of files,
+ * as most editors replace config file instead of writing to it.
+ */
+static void watch_conf_files(void) {
+    inot_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inot_fd == -1) {
+        WARN("Failed to watch config files: %s\n", strerror(errno));
+        return;
+    }
+
+    for (int i = GLOBAL; i <= CUSTOM; i++) {
+        const char *path = opts_conf_file(i);
+        if (strlen(path)) {
+            char dir[PATH_MAX + 1];
+            snprintf(dir, sizeof(dir), "%s", path);
+            char *sep = strrchr(dir, '/');
+            if (sep) {
+                *sep = '\0';
+            }
+            watches[i] = inotify_add_watch(inot_fd, sep ? dir : ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (watches[i] == -1) {
+                DEBUG("Failed to watch %s: %s\n", path, strerror(errno));
+            }
+        }
+    }
+    m_register_fd(inot_fd, true, NULL);
+}
+
+static bool is_conf_event(const struct inotify_event *ev) {
+    for (int i = GLOBAL; i <= CUSTOM; i++) {
+        if (ev->wd == watches[i] && ev->len) {
+            const char *name = strrchr(opts_conf_file(i), '/');
+            if (!strcmp(ev->name, name ? name + 1 : opts_conf_file(i))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * Load config again and publish only requests needed to apply differences.
+ * New config is kept as requests (eg: CURVE_REQ) may point to it.
+ */
+static void reload(void) {
+    static conf_t new_conf;
+
+    INFO("Reloading config.\n");
+    reload_opts(&new_conf);
+    const int changed = reload_conf(&new_conf, publish_req);
+    INFO("Config reloaded: %d value(s) changed.\n", changed);
+}
+
+/* Requests are published in batch: each one needs its own copy */
+static void publish_req(const message_t *req) {
+    message_t *msg = malloc(sizeof(message_t));
+    if (msg) {
+        memcpy(msg, req, sizeof(message_t));
+        m_publish(topics[msg->type], msg, sizeof(message_t), true);
+    }
+}
+
 /*
  * if received an external SIGINT or SIGTERM,
  * just switch the quit flag to 1 and print to stdout.
+ * On SIGHUP, or when a config file changes, reload config.
  */
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
     case FD_UPD: {
+        if (msg->fd_msg->fd == inot_fd) {
+            char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            bool changed = false;
+            ssize_t len;
+            /* Editors generate bursts of events: reload once for all of them */
+            while ((len = read(inot_fd, buf, sizeof(buf))) > 0) {
+                for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+                    changed |= is_conf_event((const struct inotify_event *)ptr);
+                }
+            }
+            if (changed) {
+                reload();
+            }
+            break;
+        }
+
         struct signalfd_siginfo fdsi;
         ssize_t s;
 
@@ -46,12 +143,15 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         if (s != sizeof(struct signalfd_siginfo)) {
             ERROR("An error occurred while getting signalfd data.\n");
         }
-        INFO("Received %d. Leaving.\n", fdsi.ssi_signo);
-        modules_quit(EXIT_SUCCESS);
+        if (fdsi.ssi_signo == SIGHUP) {
+            reload();
+        } else {
+            INFO("Received %d. Leaving.\n", fdsi.ssi_signo);
+            modules_quit(EXIT_SUCCESS);
+        }
         break;
     }
     default:
         break;
     }
 }
-
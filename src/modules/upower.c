@@ -18,6 +18,10 @@ DECLARE_MSG(inh_req, INHIBIT_REQ);
 MODULE("UPOWER");
 
 static void init(void) {
+    /* Consumed by upower_check() on LOOP_STARTED */
+    SYSBUS_ARG(lid_pres_args, "org.freedesktop.UPower",  "/org/freedesktop/UPower", "org.freedesktop.UPower", "LidIsPresent");
+    get_property_prefetch(&lid_pres_args);
+    
     M_SUB(UPOWER_REQ);
     M_SUB(LID_REQ);
 }
@@ -0,0 +1,152 @@
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <systemd/sd-daemon.h>
+#include "bus.h"
+#include "notify.h"
+
+#define READY_TIMEOUT 30                    // seconds to wait for startup steps before notifying readiness anyway
+
+static void ping(void);
+static void *stall_detector(void *arg);
+static uint64_t now_us(void);
+
+static int ready_fd = -1, wd_fd = -1;
+static uint64_t wd_usec;                    // watchdog timeout requested by service manager
+static atomic_uint_fast64_t last_ping;      // last time main loop pinged service manager
+static atomic_bool stalled;                 // set by stall detector, cleared by main loop once it is back
+static bool detector_running;
+static pthread_t detector;
+static pthread_mutex_t detector_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t detector_cond = PTHREAD_COND_INITIALIZER;
+
+MODULE("WATCHDOG");
+
+/*
+ * Only started by a service manager (ie: systemd clight.service).
+ * Notify readiness anyway after READY_TIMEOUT, eg: while BACKLIGHT still waits for a location.
+ * If watchdog is enabled, ping it from main loop twice per timeout,
+ * and let a stall detector thread report what main loop is stuck on
+ * before service manager kills us.
+ */
+static void init(void) {
+    ready_fd = start_timer(CLOCK_MONOTONIC, READY_TIMEOUT, 0);
+    m_register_fd(ready_fd, true, NULL);
+
+    if (sd_watchdog_enabled(0, &wd_usec) > 0) {
+        wd_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (wd_fd == -1) {
+            WARN("Failed to create watchdog timer: %s\n", strerror(errno));
+            return;
+        }
+        const uint64_t interval = wd_usec / 2;
+        struct itimerspec timer = {
+            .it_interval = { interval / 1000000, (interval % 1000000) * 1000 },
+            .it_value = { interval / 1000000, (interval % 1000000) * 1000 },
+        };
+        timerfd_settime(wd_fd, 0, &timer, NULL);
+        m_register_fd(wd_fd, true, NULL);
+
+        atomic_store(&last_ping, now_us());
+        detector_running = pthread_create(&detector, NULL, stall_detector, NULL) == 0;
+        if (!detector_running) {
+            WARN("Failed to start stall detector.\n");
+        }
+        INFO("Watchdog enabled with %.1lf s timeout.\n", wd_usec / 1000000.0);
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard && getenv("NOTIFY_SOCKET");
+}
+
+static void destroy(void) {
+    if (detector_running) {
+        pthread_mutex_lock(&detector_mtx);
+        detector_running = false;
+        pthread_cond_signal(&detector_cond);
+        pthread_mutex_unlock(&detector_mtx);
+        pthread_join(detector, NULL);
+    }
+    if (wd_fd >= 0) {
+        close(wd_fd);
+    }
+    if (ready_fd >= 0) {
+        close(ready_fd);
+    }
+    sd_notify(0, "STOPPING=1");
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD:
+        read_timer(msg->fd_msg->fd);
+        if (msg->fd_msg->fd == wd_fd) {
+            ping();
+        } else {
+            if (!notify_is_ready()) {
+                WARN("Startup is taking more than %d s. Notifying readiness anyway.\n", READY_TIMEOUT);
+                notify_ready_force();
+            }
+            m_deregister_fd(ready_fd);
+            ready_fd = -1;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Main loop is alive: ping service manager, and report any stall it just recovered from */
+static void ping(void) {
+    const uint64_t now = now_us();
+    const uint64_t prev = atomic_exchange(&last_ping, now);
+    sd_notify(0, "WATCHDOG=1");
+    if (atomic_exchange(&stalled, false)) {
+        WARN("Main loop was stalled for %.1lf s.\n", (now - prev) / 1000000.0);
+        sd_notify(0, "STATUS=Running.");
+    }
+}
+
+/*
+ * Wake up 4 times per watchdog timeout.
+ * When main loop missed a ping, it is stuck: report it through service status and stderr,
+ * as logging is owned by main thread.
+ * Service manager will kill us if it does not recover before timeout.
+ */
+static void *stall_detector(UNUSED void *arg) {
+    pthread_mutex_lock(&detector_mtx);
+    while (detector_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        const uint64_t ns = deadline.tv_nsec + (wd_usec / 4) * 1000;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&detector_cond, &detector_mtx, &deadline);
+
+        const double since = (now_us() - atomic_load(&last_ping)) / 1000000.0;
+        if (detector_running && since * 1000000 > wd_usec * 3 / 4 && !atomic_load(&stalled)) {
+            atomic_store(&stalled, true);
+            const char *caller, *member;
+            if (bus_pending_call(&caller, &member)) {
+                sd_notifyf(0, "STATUS=Stalled for %.1lf s in %s(), waiting for %s reply.", since, caller, member);
+                fprintf(stderr, "Main loop stalled for %.1lf s in %s(), waiting for %s reply.\n", since, caller, member);
+            } else {
+                sd_notifyf(0, "STATUS=Stalled for %.1lf s.", since);
+                fprintf(stderr, "Main loop stalled for %.1lf s.\n", since);
+            }
+        }
+    }
+    pthread_mutex_unlock(&detector_mtx);
+    return NULL;
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
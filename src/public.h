@@ -28,12 +28,30 @@
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
-#define DEBUG(msg, ...) log_message(__FILENAME__, __LINE__, 'D', msg, ##__VA_ARGS__)
-#define INFO(msg, ...)  log_message(__FILENAME__, __LINE__, 'I', msg, ##__VA_ARGS__)
-#define WARN(msg, ...)  log_message(__FILENAME__, __LINE__, 'W', msg, ##__VA_ARGS__)
+/*
+ * Log level is checked inline, before any argument gets evaluated, against CLIGHT_LOG_LVL.
+ * External modules follow default log level; Clight sources override it with their own module one.
+ */
+#ifndef CLIGHT_LOG_LVL
+#define CLIGHT_LOG_LVL              (*clight_default_log_lvl)
+#endif
+#define LOG_ENABLED(lvl)            ((lvl) <= CLIGHT_LOG_LVL)
+#define LOG(lvl, type, msg, ...)    do { if (LOG_ENABLED(lvl)) log_message(__FILENAME__, __LINE__, type, msg, ##__VA_ARGS__); } while (0)
+
+#ifdef NO_DEBUG_LOG
+/* Compiled out; still type-check format and args */
+#define DEBUG(msg, ...) do { if (0) log_message(__FILENAME__, __LINE__, 'D', msg, ##__VA_ARGS__); } while (0)
+#else
+#define DEBUG(msg, ...) LOG(LOG_LVL_DEBUG, 'D', msg, ##__VA_ARGS__)
+#endif
+#define INFO(msg, ...)  LOG(LOG_LVL_INFO, 'I', msg, ##__VA_ARGS__)
+#define WARN(msg, ...)  LOG(LOG_LVL_WARN, 'W', msg, ##__VA_ARGS__)
 
 /** Generic Enums **/
 
+/* Log levels: any message above current module level is discarded */
+enum log_levels { LOG_LVL_ERROR, LOG_LVL_WARN, LOG_LVL_INFO, LOG_LVL_DEBUG, LOG_LVL_SIZE };
+
 /*
  * List of states clight can be through: 
  * day between sunrise and sunset
@@ -41,6 +59,13 @@
  */
 enum day_states { DAY, NIGHT, SIZE_STATES };
 
+/*
+ * Twilight phases, given sun elevation:
+ * night below -18°, astronomical twilight until -12°,
+ * nautical twilight until -6°, civil twilight until sunrise/sunset, then day.
+ */
+enum day_phases { PHASE_NIGHT, PHASE_ASTRONOMICAL, PHASE_NAUTICAL, PHASE_CIVIL, PHASE_DAY, SIZE_PHASES };
+
 /* List of events: sunrise and sunset */
 enum day_events { SUNRISE, SUNSET, SIZE_EVENTS };
 
@@ -99,6 +124,10 @@ enum mod_msg_types {
     PM_REQ,             // Publish to set a new PowerManagement inhibition state
     SENS_UPD,           // Subscribe to receive "SensorAvail" states
     NEXT_DAYEVT_UPD,    // Subscribe to receive notifications about next day event (ie: sunrise or sunset)
+    GAMMA_OUT_UPD,      // Subscribe to receive new per-output gamma temperatures
+    DAYPHASE_UPD,       // Subscribe to receive new twilight phases
+    BL_PHASE_TO_REQ,    // Publish to set new backlight timeouts for each twilight phase, for given ac state
+    PHASE_TEMP_REQ,     // Publish to set new gamma temps for each twilight phase
     MSGS_SIZE
 };
 
@@ -165,12 +194,22 @@ typedef struct {
     int timeout;                // Only useful for requests. Valued in updates
 } temp_upd;
 
+typedef struct {
+    int changed;                // Valued in updates. Bitmask of outputs whose temperature changed, in the same order as gamma conf outputs
+} gamma_out_upd;
+
 typedef struct {
     int new;                    // Mandatory for requests
     enum ac_states state;       // Mandatory for requests. Special value: -1 -> use current ac state
     enum day_states daytime;    // Mandatory for BL_TO_REQ only. Special value: -1 -> use current daytime
 } timeout_upd;
 
+typedef struct {
+    enum ac_states state;       // Mandatory for BL_PHASE_TO_REQ only. Special value: -1 -> use current ac state
+    bool enabled;               // Mandatory for requests. Whether values are used in place of daytime ones
+    int values[SIZE_PHASES];    // Mandatory for requests, when enabled
+} phase_upd;
+
 typedef struct {
     enum ac_states state;       // Mandatory for requests. Special value: -1 -> use current ac state
     int num_points;             // Mandatory for requests
@@ -212,10 +251,12 @@ typedef struct {
         inhibit_upd inhibit;    /* INHIBIT_UPD/INHIBIT_REQ */
         pm_upd pm;              /* PM_UPD/PM_REQ */
         display_upd display;    /* DISPLAY_UPD/DISPLAY_REQ */
-        daytime_upd day_time;   /* TIME_UPD/IN_EVENT_UPD */
+        daytime_upd day_time;   /* TIME_UPD/IN_EVENT_UPD/DAYPHASE_UPD */
         evt_upd event;          /* SUNRISE_UPD/SUNSET_UPD/SUNRISE_REQ/SUNSET_REQ/NEXT_DAYEVT_UPD */
         temp_upd temp;          /* TEMP_UPD/TEMP_REQ */
+        gamma_out_upd gamma_out; /* GAMMA_OUT_UPD */
         timeout_upd to;         /* DIMMER_TO_REQ/DPMS_TO_REQ/SCR_TO_REQ/BL_TO_REQ */
+        phase_upd phase;        /* BL_PHASE_TO_REQ/PHASE_TEMP_REQ */
         curve_upd curve;        /* CURVE_REQ */
         calib_upd nocalib;      /* NO_AUTOCALIB_REQ */
         bl_upd bl;              /* AMBIENT_BR_UPD/BL_UPD/KBD_BL_UPD/SCR_BL_UPD/BL_REQ/KBD_BL_REQ */
@@ -231,3 +272,5 @@ extern const char *topics[];
 /** Log function declaration **/
 
 void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...);
+const int *log_level_ref(const char *filename);
+extern const int *const clight_default_log_lvl;
@@ -37,6 +37,10 @@ const char *topics[] = {
     "PmInhibited",
     "PmReq",
     "SensorAvail",
-    "NextEvent"
+    "NextEvent",
+    "GammaOutputs",
+    "DayPhase",
+    "ReqBlPhaseTo",
+    "ReqPhaseTemp"
 };
 _Static_assert(sizeof(topics) / sizeof(*topics) == MSGS_SIZE, "Undefined topic.");
@@ -36,6 +36,18 @@ bool validate_timeout(timeout_upd *up) {
     return false;
 }
 
+bool validate_phase(phase_upd *up) {
+    if (up->state == -1) {
+        up->state = state.ac_state;
+    }
+    
+    if (up->state >= ON_AC && up->state < SIZE_AC) {
+        return true;
+    }
+    DEBUG("Failed to validate phase request.\n");
+    return false;
+}
+
 bool validate_inhibit(inhibit_upd *up) {
     if (state.inhibited != up->new) {
         return true;
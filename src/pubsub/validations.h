@@ -7,6 +7,7 @@
     upower_upd *: validate_upower, \
     inhibit_upd *: validate_inhibit, \
     timeout_upd *: validate_timeout, \
+    phase_upd *: validate_phase, \
     contrib_upd *: validate_contrib, \
     evt_upd *: validate_evt, \
     temp_upd *: validate_temp, \
@@ -20,6 +21,7 @@
 bool validate_loc(loc_upd *up);
 bool validate_upower(upower_upd *up);
 bool validate_timeout(timeout_upd *up);
+bool validate_phase(phase_upd *up);
 bool validate_inhibit(inhibit_upd *up);
 bool validate_contrib(contrib_upd *up);
 bool validate_evt(evt_upd *up);
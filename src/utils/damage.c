@@ -0,0 +1,95 @@
+#include "damage.h"
+
+/*
+ * Screen content change notifications through X Damage extension.
+ * When Clight is built without it, damage_init() fails
+ * and callers fallback at their fixed timers.
+ * A lost X connection is reported by damage_drain() instead of
+ * letting Xlib exit the process.
+ */
+
+#ifdef XDAMAGE_PRESENT
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+
+static Display *dpy;
+static Damage damage;
+static int damage_ev_base;
+static bool io_error;
+
+/* Called in place of exit() once Xlib reported an IO error on dpy */
+static void on_io_error(UNUSED Display *d, UNUSED void *userdata) {
+    io_error = true;
+}
+
+/*
+ * Start listening for root window damages on state.display.
+ * Returns the X connection fd to be polled, or a negative value on failure.
+ */
+int damage_init(void) {
+    int err_base;
+    dpy = XOpenDisplay(state.display);
+    if (!dpy) {
+        return -ENODEV;
+    }
+    io_error = false;
+    XSetIOErrorExitHandler(dpy, on_io_error, NULL);
+    if (!XDamageQueryExtension(dpy, &damage_ev_base, &err_base)) {
+        damage_destroy();
+        return -ENOTSUP;
+    }
+    damage = XDamageCreate(dpy, DefaultRootWindow(dpy), XDamageReportNonEmpty);
+    XFlush(dpy);
+    return ConnectionNumber(dpy);
+}
+
+/*
+ * Consume any pending X event, acknowledging damages so that
+ * a new notification is sent on next screen change.
+ * Returns 1 if screen content changed, 0 if not,
+ * -EIO if X connection was lost.
+ */
+int damage_drain(void) {
+    bool damaged = false;
+    while (!io_error && XPending(dpy)) {
+        XEvent ev;
+        XNextEvent(dpy, &ev);
+        if (ev.type == damage_ev_base + XDamageNotify) {
+            damaged = true;
+        }
+    }
+    if (damaged && !io_error) {
+        XDamageSubtract(dpy, damage, None, None);
+        XFlush(dpy);
+    }
+    return io_error ? -EIO : damaged;
+}
+
+void damage_destroy(void) {
+    if (dpy) {
+        if (damage && !io_error) {
+            XDamageDestroy(dpy, damage);
+        }
+        damage = 0;
+        /* Does not talk to X server anymore after an IO error */
+        XCloseDisplay(dpy);
+        dpy = NULL;
+    }
+}
+
+#else
+
+int damage_init(void) {
+    return -ENOTSUP;
+}
+
+int damage_drain(void) {
+    return 0;
+}
+
+void damage_destroy(void) {
+    
+}
+
+#endif
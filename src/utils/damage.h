@@ -0,0 +1,7 @@
+#pragma once
+
+#include "commons.h"
+
+int damage_init(void);
+int damage_drain(void);
+void damage_destroy(void);
@@ -0,0 +1,239 @@
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include "evidle.h"
+
+/*
+ * In-process idle detection, reading user input devices.
+ * Devices are not polled while user is active:
+ * on each deadline, pending events are drained and their (monotonic) kernel timestamps
+ * tell when user was last active, thus main loop never wakes up on input.
+ * Only while idle, devices are registered to get notified of first activity.
+ * Requires read access to /dev/input/event* (ie: being in "input" group).
+ */
+
+#define INPUT_DIR "/dev/input"
+#define MAX_INPUT_DEVS 64
+#define BIT_SET(bits, n) ((bits)[(n) / (8 * sizeof(long))] & (1UL << ((n) % (8 * sizeof(long)))))
+
+typedef struct {
+    int fd;
+    dev_t rdev;                             // device number, as names are reused by a new device once unplugged
+    char name[NAME_MAX + 1];                // eg: "event3"
+} input_dev_t;
+
+static int find_device(const char *name);
+static int open_device(const char *name);
+static bool is_user_input(int fd);
+static void close_device(int idx);
+
+static input_dev_t devs[MAX_INPUT_DEVS];
+static int num_devs;
+static int inot_fd = -1;
+static bool watching;
+static evidle_fd_cb fd_cb;
+
+/*
+ * Open any user input device, and watch INPUT_DIR for new ones (eg: uinput virtual devices).
+ * cb is used to (de)register fds in caller module.
+ * Returns number of opened devices, or -1 when none is readable.
+ */
+int evidle_init(evidle_fd_cb cb) {
+    fd_cb = cb;
+    DIR *d = opendir(INPUT_DIR);
+    if (!d) {
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        open_device(entry->d_name);
+    }
+    closedir(d);
+    
+    if (num_devs == 0) {
+        return -1;
+    }
+    
+    /* Permissions are set by udev after creation: retry on attributes change too */
+    inot_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inot_fd == -1 || inotify_add_watch(inot_fd, INPUT_DIR, IN_CREATE | IN_ATTRIB | IN_DELETE) == -1) {
+        DEBUG("Failed to watch %s: %s\n", INPUT_DIR, strerror(errno));
+    } else {
+        fd_cb(inot_fd, true);
+    }
+    return num_devs;
+}
+
+static int find_device(const char *name) {
+    for (int i = 0; i < num_devs; i++) {
+        if (!strcmp(devs[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Open an input device, unless it is already open.
+ * A device with same name but different device number replaced an unplugged one
+ * whose removal was not noticed yet: close the old one first.
+ */
+static int open_device(const char *name) {
+    if (strncmp(name, "event", strlen("event"))) {
+        return -1;
+    }
+    
+    char path[PATH_MAX + 1];
+    snprintf(path, sizeof(path), "%s/%s", INPUT_DIR, name);
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        return -1;
+    }
+    
+    const int idx = find_device(name);
+    if (idx != -1) {
+        if (devs[idx].rdev == st.st_rdev) {
+            return -1;
+        }
+        close_device(idx);
+    }
+    if (num_devs == MAX_INPUT_DEVS) {
+        return -1;
+    }
+    
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    /* Event timestamps are compared against CLOCK_MONOTONIC deadlines */
+    int clk = CLOCK_MONOTONIC;
+    if (!is_user_input(fd) || ioctl(fd, EVIOCSCLOCKID, &clk) == -1) {
+        close(fd);
+        return -1;
+    }
+    
+    devs[num_devs].fd = fd;
+    devs[num_devs].rdev = st.st_rdev;
+    strncpy(devs[num_devs].name, name, NAME_MAX);
+    num_devs++;
+    if (watching) {
+        fd_cb(fd, true);
+    }
+    DEBUG("Watching %s for user activity.\n", path);
+    return fd;
+}
+
+/*
+ * Keyboards, mice, touchpads and buttons.
+ * Switches (eg: lid) and accelerometers would otherwise keep us from being idle.
+ */
+static bool is_user_input(int fd) {
+    unsigned long ev_bits[EV_MAX / (8 * sizeof(long)) + 1] = {0};
+    unsigned long prop_bits[INPUT_PROP_MAX / (8 * sizeof(long)) + 1] = {0};
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits) == -1) {
+        return false;
+    }
+    ioctl(fd, EVIOCGPROP(sizeof(prop_bits)), prop_bits);
+    return (BIT_SET(ev_bits, EV_KEY) || BIT_SET(ev_bits, EV_REL)) && !BIT_SET(prop_bits, INPUT_PROP_ACCELEROMETER);
+}
+
+static void close_device(int idx) {
+    if (watching) {
+        fd_cb(devs[idx].fd, false);
+    }
+    close(devs[idx].fd);
+    DEBUG("Stopped watching %s/%s.\n", INPUT_DIR, devs[idx].name);
+    devs[idx] = devs[--num_devs];
+}
+
+/*
+ * Drain any pending input event.
+ * Returns true if any, storing latest event timestamp in last.
+ */
+bool evidle_last_activity(struct timespec *last) {
+    bool active = false;
+    for (int i = num_devs - 1; i >= 0; i--) {
+        struct input_event evs[64];
+        ssize_t len;
+        while ((len = read(devs[i].fd, evs, sizeof(evs))) > 0) {
+            for (size_t j = 0; j < len / sizeof(struct input_event); j++) {
+                const struct input_event *ev = &evs[j];
+                /* 
+                 * Skip switches and output events (eg: leds set by compositor).
+                 * EV_SYN is kept: on buffer overflow, only SYN_DROPPED and latest event are left.
+                 */
+                if (ev->type == EV_SW || ev->type == EV_LED || ev->type == EV_SND || 
+                    ev->type == EV_FF || ev->type == EV_FF_STATUS) {
+                    continue;
+                }
+                if (!active || ev->input_event_sec > last->tv_sec || 
+                    (ev->input_event_sec == last->tv_sec && ev->input_event_usec * 1000 > last->tv_nsec)) {
+                    
+                    last->tv_sec = ev->input_event_sec;
+                    last->tv_nsec = ev->input_event_usec * 1000;
+                    active = true;
+                }
+            }
+        }
+        if (len == -1 && errno == ENODEV) {
+            /* Device was unplugged */
+            close_device(i);
+        }
+    }
+    return active;
+}
+
+/* Register devices to be notified of first activity, or deregister them */
+void evidle_watch(bool watch) {
+    if (watch != watching) {
+        for (int i = 0; i < num_devs; i++) {
+            if (watch) {
+                fd_cb(devs[i].fd, true);
+            } else {
+                fd_cb(devs[i].fd, false);
+            }
+        }
+        watching = watch;
+    }
+}
+
+bool evidle_is_hotplug(int fd) {
+    return fd == inot_fd;
+}
+
+/* Open new input devices, and close removed ones */
+void evidle_hotplug(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(inot_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            if (!ev->len) {
+                continue;
+            }
+            if (ev->mask & IN_DELETE) {
+                const int idx = find_device(ev->name);
+                if (idx != -1) {
+                    close_device(idx);
+                }
+            } else {
+                open_device(ev->name);
+            }
+        }
+    }
+}
+
+void evidle_destroy(void) {
+    evidle_watch(false);
+    while (num_devs > 0) {
+        close_device(num_devs - 1);
+    }
+    if (inot_fd >= 0) {
+        close(inot_fd);
+        inot_fd = -1;
+    }
+}
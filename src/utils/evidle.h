@@ -0,0 +1,13 @@
+#pragma once
+
+#include "commons.h"
+
+/* Register (watch = true) or deregister fd in caller module */
+typedef void (*evidle_fd_cb)(int fd, bool watch);
+
+int evidle_init(evidle_fd_cb cb);
+bool evidle_last_activity(struct timespec *last);
+void evidle_watch(bool watch);
+bool evidle_is_hotplug(int fd);
+void evidle_hotplug(void);
+void evidle_destroy(void);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Binary event log format, shared with clight-evlog decoder.
+ * File starts with an evlog_header_t, followed by num_mods module names
+ * (EVLOG_MOD_NAME_LEN bytes each, NUL padded), then by fixed-size evlog_record_t.
+ * All fields are in host byte order.
+ */
+#define EVLOG_MAGIC "CLEV"
+#define EVLOG_VERSION 1
+#define EVLOG_MOD_NAME_LEN 16
+
+enum evlog_types {
+    EVLOG_AMBIENT_BR,                       // captured ambient brightness
+    EVLOG_BL_PCT,                           // backlight pct set
+    EVLOG_CAPTURE_LAT,                      // sensor capture latency, in ms
+    EVLOG_KBD_PCT,                          // keyboard backlight pct set
+    EVLOG_TEMP,                             // gamma temperature set
+    EVLOG_SCREEN_COMP,                      // screen-emitted brightness compensation
+    EVLOG_DISPLAY,                          // display state
+    EVLOG_DISPLAY_LAT,                      // dim/dpms batch completion latency on all outputs, in ms
+    EVLOG_SIZE
+};
+
+static const char *evlog_type_names[EVLOG_SIZE] __attribute__((unused)) = {
+    "ambient_br", "bl_pct", "capture_latency", "kbd_pct", "temp", "screen_comp", "display", "display_latency"
+};
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;                   // sizeof(evlog_record_t) of the writer
+    uint16_t num_mods;                      // number of module names following header
+    uint16_t reserved;
+} evlog_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t ts_us;                         // CLOCK_REALTIME timestamp, in us
+    uint16_t module;                        // index in module names table
+    uint16_t type;                          // enum evlog_types
+    uint32_t reserved;
+    double value;
+} evlog_record_t;
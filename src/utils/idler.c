@@ -42,6 +42,12 @@ static int idle_get_client(char *client) {
     return call(&args, NULL);
 }
 
+/* Issue GetClient call early; consumed by idle_init() */
+int idle_prefetch_client(void) {
+    SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Idle", "org.clightd.clightd.Idle", "GetClient");
+    return call_prefetch(&args, NULL);
+}
+
 static int idle_hook_update(char *client, sd_bus_slot **slot, sd_bus_message_handler_t handler) {
     SYSBUS_ARG(args, CLIGHTD_SERVICE, client, "org.clightd.clightd.Idle.Client", "Idle");
     return add_match(&args, slot, handler);
@@ -86,6 +92,11 @@ int idle_client_reset(char *client, int timeout) {
 }
 
 int idle_client_destroy(char *client) {
+    if (client && !strlen(client)) {
+        /* Release client created by an unused GetClient prefetch */
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, client, CLIGHTD_SERVICE, "/org/clightd/clightd/Idle", "org.clightd.clightd.Idle", "GetClient");
+        drop_prefetch(&args);
+    }
     VALIDATE_CLIENT(client);
     
     /* Properly stop client */
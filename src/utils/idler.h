@@ -2,6 +2,7 @@
 
 #include "bus.h"
 
+int idle_prefetch_client(void);
 int idle_init(char *client, sd_bus_slot **slot, int timeout, sd_bus_message_handler_t handler);
 int idle_set_timeout(char *client, int timeout);
 int idle_client_start(char *client, int timeout);
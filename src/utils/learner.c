@@ -0,0 +1,167 @@
+#include <sys/stat.h>
+#include "learner.h"
+
+/*
+ * Histogram of how long user took to come back from idle, for each hour of week,
+ * used to adapt dimmer timeout:
+ * a dim undone within seconds is wasted (2 transitions and a few bus calls),
+ * while a user that rarely comes back soon can be dimmed earlier.
+ * Every idle period longer than shortest adapted timeout is a sample, whether screen got dimmed or not,
+ * measured from when configured timeout elapsed (thus negative when user came back before it),
+ * so that samples do not depend on the adapted timeout they were recorded under.
+ */
+
+#define LEARN_MAGIC "CLIH"
+#define LEARN_VERSION 3                     // 1 measured samples from adapted timeout, 2 only sampled dimmed periods
+#define HOURS_OF_WEEK (7 * 24)
+#define LEARN_MIN_SAMPLES 6                 // samples needed in an hour before adapting its timeout
+#define LEARN_MAX_SAMPLES 1024              // an hour histogram is halved when reached, to follow habit changes
+
+/* Upper bound (in seconds) of each bin; first bin holds users back before configured timeout, last one is unbounded */
+static const int bins_limits[] = { 0, 10, 30, 60, 300, 900 };
+#define NUM_BINS (int)(sizeof(bins_limits) / sizeof(*bins_limits) + 1)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint16_t bins[HOURS_OF_WEEK][NUM_BINS];
+} learn_hist_t;
+
+static void learn_path(char *path);
+static int hour_of_week(time_t t);
+
+static learn_hist_t hist;
+static bool loaded;
+
+static void learn_path(char *path) {
+    if (getenv("XDG_DATA_HOME")) {
+        snprintf(path, PATH_MAX, "%s/clight/", getenv("XDG_DATA_HOME"));
+    } else {
+        snprintf(path, PATH_MAX, "%s/.local/share/clight/", getpwuid(getuid())->pw_dir);
+    }
+    mkdir(path, 0755);
+    strncat(path, "idle.hist", PATH_MAX - strlen(path));
+}
+
+static int hour_of_week(time_t t) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return tm.tm_wday * 24 + tm.tm_hour;
+}
+
+/* Load histogram; start from an empty one if missing or written by an incompatible version */
+void learn_load(void) {
+    char path[PATH_MAX + 1];
+    learn_path(path);
+    
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fread(&hist, sizeof(hist), 1, f) != 1 || 
+            memcmp(hist.magic, LEARN_MAGIC, sizeof(hist.magic)) || hist.version != LEARN_VERSION) {
+            
+            DEBUG("Discarding incompatible %s.\n", path);
+            memset(&hist, 0, sizeof(hist));
+        }
+        fclose(f);
+    }
+    memcpy(hist.magic, LEARN_MAGIC, sizeof(hist.magic));
+    hist.version = LEARN_VERSION;
+    loaded = true;
+}
+
+/*
+ * Store an idle period started at idle_at, ended by user back_after seconds
+ * after configured dimmer timeout elapsed; negative if user came back before it.
+ */
+void learn_record(time_t idle_at, double back_after) {
+    if (!loaded) {
+        learn_load();
+    }
+    
+    uint16_t *bins = hist.bins[hour_of_week(idle_at)];
+    int b = 0;
+    while (b < NUM_BINS - 1 && back_after >= bins_limits[b]) {
+        b++;
+    }
+    
+    int total = 0;
+    for (int i = 0; i < NUM_BINS; i++) {
+        total += bins[i];
+    }
+    if (total >= LEARN_MAX_SAMPLES) {
+        for (int i = 0; i < NUM_BINS; i++) {
+            bins[i] /= 2;
+        }
+    }
+    bins[b]++;
+    DEBUG("User back %.1lf s %s configured dimmer timeout.\n", fabs(back_after), back_after < 0 ? "before" : "after");
+    learn_store();
+}
+
+/*
+ * Adapt dimmer timeout to current hour of week habits:
+ * doubled when most dims at configured timeout were undone within 10s, 1.5x when many were;
+ * cut by a quarter when user rarely came back before configured timeout, nor within a minute after it.
+ * As samples are relative to configured timeout, result is always
+ * computed from it, never from a previously adapted one.
+ */
+int learn_dim_timeout(int timeout) {
+    if (!loaded) {
+        learn_load();
+    }
+    
+    if (timeout <= 0) {
+        return timeout;
+    }
+    
+    const uint16_t *bins = hist.bins[hour_of_week(time(NULL))];
+    int total = 0, within_min = 0;
+    for (int i = 0; i < NUM_BINS; i++) {
+        total += bins[i];
+        if (i < NUM_BINS - 1 && bins_limits[i] <= 60) {
+            within_min += bins[i];
+        }
+    }
+    if (total < LEARN_MIN_SAMPLES) {
+        return timeout;
+    }
+    
+    /* Users back before configured timeout would not have been dimmed by it */
+    const int dimmed = total - bins[0];
+    if (dimmed >= LEARN_MIN_SAMPLES) {
+        const double wasted = (double)bins[1] / dimmed;
+        if (wasted >= 0.5) {
+            return timeout * 2;
+        }
+        if (wasted >= 0.25) {
+            return timeout * 3 / 2;
+        }
+    }
+    if ((double)within_min / total <= 0.1) {
+        return learn_min_timeout(timeout);
+    }
+    return timeout;
+}
+
+/* Shortest timeout configured one can be adapted to: idle periods are sampled from there */
+int learn_min_timeout(int timeout) {
+    const int shorter = timeout * 3 / 4;
+    return shorter > 10 ? shorter : (timeout < 10 ? timeout : 10);
+}
+
+/* Atomically replace histogram file */
+void learn_store(void) {
+    char path[PATH_MAX + 1], tmp_path[PATH_MAX + 1];
+    learn_path(path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    
+    FILE *f = fopen(tmp_path, "w");
+    if (f) {
+        const bool ok = fwrite(&hist, sizeof(hist), 1, f) == 1;
+        if (fclose(f) == 0 && ok && rename(tmp_path, path) == 0) {
+            return;
+        }
+        unlink(tmp_path);
+    }
+    DEBUG("Failed to store %s.\n", path);
+}
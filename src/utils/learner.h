@@ -0,0 +1,9 @@
+#pragma once
+
+#include "commons.h"
+
+void learn_load(void);
+void learn_record(time_t idle_at, double back_after);
+int learn_dim_timeout(int timeout);
+int learn_min_timeout(int timeout);
+void learn_store(void);
@@ -1,7 +1,28 @@
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "commons.h"
 
+#define LOG_RING_SIZE 256                   // number of preallocated log records
+#define LOG_RECORD_SIZE 512                 // max length of a log record
+#define LOG_FLUSH_MS 1000                   // max time a record waits before being written
+#define LOG_MOD_DEFAULT 0                   // level used by any file that is not a module
+
+/*
+ * Log records are formatted by the main thread into a preallocated
+ * single producer/single consumer ring, then written and flushed in batches
+ * by a background writer thread.
+ * Binary event log records ('B' type) travel the same ring, as a raw evlog_record_t.
+ */
+typedef struct {
+    char type;
+    int msg_off;                            // offset of message (without header) inside text
+    char text[LOG_RECORD_SIZE];
+} log_record_t;
+
 static void log_bl_conf(bl_conf_t *bl_conf);
 static void log_sens_conf(sensor_conf_t *sens_conf);
 static void log_kbd_conf(kbd_conf_t *kbd_conf);
@@ -9,23 +30,59 @@ static void log_gamma_conf(gamma_conf_t *gamma_conf);
 static void log_daytime_conf(daytime_conf_t *day_conf);
 static void log_dim_conf(dimmer_conf_t *dim_conf);
 static void log_dpms_conf(dpms_conf_t *dpms_conf);
+static void log_hook_conf(idle_hook_conf_t *hook_conf);
 static void log_scr_conf(screen_conf_t *screen_conf);
 static void log_inh_conf(inh_conf_t *inh_conf);
+static void log_dir(char *path);
+static void *log_writer(void *arg);
+static void log_drain(void);
+static void log_write_pending(void);
+static void log_write_record(const log_record_t *rec);
+static void log_flush_files(void);
+static void log_shift_backups(const char *path, int files);
+static void log_rotate(void);
+static log_record_t *log_reserve(void);
+static void log_commit(void);
+static void evlog_create(void);
+static void evlog_write(const evlog_record_t *ev);
+static void log_locked_warn(int lineno, const char *log_msg, ...);
+static const char *log_timestamp(void);
 
 static FILE *log_file;
+static char log_path[PATH_MAX + 1];
+static log_record_t log_ring[LOG_RING_SIZE];
+static atomic_uint log_head, log_tail;      // producer writes at head, consumer reads at tail
+static atomic_bool log_running;
+static pthread_t log_thread;
+static pthread_mutex_t log_drain_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int log_efd = -1;
+static FILE *evlog_file;
+static char evlog_path[PATH_MAX + 1];
+/* Writer thread copy of conf limits: conf is rebuilt in place on reload */
+static atomic_int log_max_size = 1024, log_max_files = 3, evlog_max_size = 1024;
 
-void open_log(void) {
-    char log_path[PATH_MAX + 1] = {0};
+/* Modules with their own log level, matched against source file name */
+static const char *log_mods[] = { 
+    "default", "backlight", "bus", "daytime", "display", "gamma", "idle", "inhibit", 
+    "interface", "keyboard", "location", "pm", "screen", "signal", "upower", "watchdog", "wizard"
+};
+#define LOG_MODS_SIZE (int)(sizeof(log_mods) / sizeof(*log_mods))
+static int log_levels[LOG_MODS_SIZE] = { [0 ... LOG_MODS_SIZE - 1] = LOG_LVL_INFO };
+const int *const clight_default_log_lvl = &log_levels[LOG_MOD_DEFAULT];   // used by external modules
+static bool log_overridden[LOG_MODS_SIZE];  // whether module level was explicitly set, thus not following default one
 
+/* Fill path with XDG_DATA_HOME/clight/ folder, creating it if it does not exist */
+static void log_dir(char *path) {
     if (getenv("XDG_DATA_HOME")) {
-        snprintf(log_path, PATH_MAX, "%s/clight/", getenv("XDG_DATA_HOME"));
+        snprintf(path, PATH_MAX, "%s/clight/", getenv("XDG_DATA_HOME"));
     } else {
-        snprintf(log_path, PATH_MAX, "%s/.local/share/clight/", getpwuid(getuid())->pw_dir);
+        snprintf(path, PATH_MAX, "%s/.local/share/clight/", getpwuid(getuid())->pw_dir);
     }
+    mkdir(path, 0755);
+}
 
-    /* Create XDG_DATA_HOME/clight/ folder if it does not exist! */
-    mkdir(log_path, 0755);
-
+void open_log(void) {
+    log_dir(log_path);
     strcat(log_path, "clight.log");
     int fd = open(log_path, O_CREAT | O_WRONLY, 0644);
     if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
@@ -39,6 +96,241 @@ void open_log(void) {
     } 
     
     ftruncate(fd, 0);
+    
+    log_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (log_efd >= 0) {
+        atomic_store(&log_running, true);
+        if (pthread_create(&log_thread, NULL, log_writer, NULL) != 0) {
+            atomic_store(&log_running, false);
+            WARN("Failed to start log writer. Logging synchronously.\n");
+        }
+    }
+}
+
+/*
+ * Open binary event log, if enabled.
+ * Previous run events are kept in clight.evlog.1.
+ * Called once config is parsed; no other instance can be running as we own clight.log lock.
+ */
+void open_evlog(void) {
+    if (conf.event_log) {
+        log_dir(evlog_path);
+        strcat(evlog_path, "clight.evlog");
+        
+        char old_path[PATH_MAX + 1];
+        snprintf(old_path, sizeof(old_path), "%s.1", evlog_path);
+        rename(evlog_path, old_path);
+        
+        pthread_mutex_lock(&log_drain_mtx);
+        evlog_create();
+        pthread_mutex_unlock(&log_drain_mtx);
+    }
+}
+
+/*
+ * Create a new event log file, writing its header and module names table.
+ * Called with log lock held (by writer thread too, on rotation): never log through the ring.
+ */
+static void evlog_create(void) {
+    evlog_file = fopen(evlog_path, "w");
+    if (!evlog_file) {
+        log_locked_warn(__LINE__, "Failed to open event log %s: %s\n", evlog_path, strerror(errno));
+        return;
+    }
+    
+    evlog_header_t hdr = { .version = EVLOG_VERSION, .record_size = sizeof(evlog_record_t), .num_mods = LOG_MODS_SIZE };
+    memcpy(hdr.magic, EVLOG_MAGIC, sizeof(hdr.magic));
+    fwrite(&hdr, sizeof(hdr), 1, evlog_file);
+    for (int i = 0; i < LOG_MODS_SIZE; i++) {
+        char name[EVLOG_MOD_NAME_LEN] = {0};
+        strncpy(name, log_mods[i], sizeof(name) - 1);
+        fwrite(name, sizeof(name), 1, evlog_file);
+    }
+}
+
+/* Append a record, rotating file once it would exceed event_log_size KB */
+static void evlog_write(const evlog_record_t *ev) {
+    if (!evlog_file) {
+        return;
+    }
+    
+    if (ftell(evlog_file) + (long)sizeof(*ev) > (long)atomic_load(&evlog_max_size) * 1024) {
+        char old_path[PATH_MAX + 1];
+        snprintf(old_path, sizeof(old_path), "%s.1", evlog_path);
+        fclose(evlog_file);
+        rename(evlog_path, old_path);
+        evlog_create();
+        if (!evlog_file) {
+            return;
+        }
+    }
+    fwrite(ev, sizeof(*ev), 1, evlog_file);
+}
+
+/* Writer thread: drain the ring every LOG_FLUSH_MS, or as soon as it is half full */
+static void *log_writer(UNUSED void *arg) {
+    struct pollfd pfd = { .fd = log_efd, .events = POLLIN };
+    while (atomic_load(&log_running)) {
+        if (poll(&pfd, 1, LOG_FLUSH_MS) > 0) {
+            uint64_t val;
+            read(log_efd, &val, sizeof(val));
+        }
+        log_drain();
+    }
+    return NULL;
+}
+
+static void log_drain(void) {
+    pthread_mutex_lock(&log_drain_mtx);
+    log_write_pending();
+    pthread_mutex_unlock(&log_drain_mtx);
+}
+
+/* Write any pending record, then flush once for the whole batch */
+static void log_write_pending(void) {
+    unsigned int tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    const unsigned int head = atomic_load_explicit(&log_head, memory_order_acquire);
+    if (tail != head) {
+        for (; tail != head; tail++) {
+            log_write_record(&log_ring[tail % LOG_RING_SIZE]);
+        }
+        atomic_store_explicit(&log_tail, tail, memory_order_release);
+        log_flush_files();
+    }
+}
+
+static void log_write_record(const log_record_t *rec) {
+    if (rec->type == 'B') {
+        evlog_write((const evlog_record_t *)rec->text);
+    } else {
+        if (log_file) {
+            const int max_size = atomic_load(&log_max_size);
+            if (max_size > 0 && ftell(log_file) >= (long)max_size * 1024) {
+                log_rotate();
+            }
+            fputs(rec->text, log_file);
+        }
+        fputs(rec->text + rec->msg_off, rec->type == 'E' ? stderr : stdout);
+    }
+}
+
+/* Shift path.1 ... path.(files - 2) to path.2 ... path.(files - 1), dropping oldest one */
+static void log_shift_backups(const char *path, int files) {
+    char old_path[PATH_MAX + 1], new_path[PATH_MAX + 1];
+    for (int i = files - 2; i >= 1; i--) {
+        snprintf(old_path, sizeof(old_path), "%s.%d", path, i);
+        snprintf(new_path, sizeof(new_path), "%s.%d", path, i + 1);
+        rename(old_path, new_path);
+    }
+}
+
+/*
+ * Move clight.log to clight.log.1 (keeping log_max_files files in total) and start a new one.
+ * New file is locked before atomically replacing current one:
+ * clight.log is thus always present and locked, keeping single instance guard intact.
+ * Called by writer thread: any failure is reported straight into log file,
+ * falling back to truncating it.
+ */
+static void log_rotate(void) {
+    const int max_files = atomic_load(&log_max_files);
+    if (max_files > 1) {
+        char backup_path[PATH_MAX + 1], tmp_path[PATH_MAX + 1];
+        snprintf(backup_path, sizeof(backup_path), "%s.1", log_path);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", log_path);
+        
+        int fd = open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            log_shift_backups(log_path, max_files);
+            unlink(backup_path);
+            if (link(log_path, backup_path) == 0 && rename(tmp_path, log_path) == 0) {
+                FILE *new_file = fdopen(fd, "w");
+                if (new_file) {
+                    /* Closing old file releases its lock, now that new one holds it */
+                    fclose(log_file);
+                    log_file = new_file;
+                    return;
+                }
+            }
+        }
+        log_locked_warn(__LINE__, "Log rotation failed: %s. Truncating.\n", strerror(errno));
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp_path);
+        }
+    }
+    
+    /* No backup requested, or rotation failed: start again from scratch */
+    fflush(log_file);
+    ftruncate(fileno(log_file), 0);
+    rewind(log_file);
+}
+
+/*
+ * Write a warning straight to log file and stdout, bypassing the ring.
+ * Used while holding log lock, where going through the ring could deadlock
+ * (or corrupt it, when called by writer thread, its only consumer).
+ */
+static void log_locked_warn(int lineno, const char *log_msg, ...) {
+    /* log_timestamp() cache belongs to main thread */
+    char ts[16], msg[LOG_RECORD_SIZE];
+    strftime(ts, sizeof(ts), "%H:%M:%S", localtime_r(&(time_t){ time(NULL) }, &(struct tm){0}));
+    va_list args;
+    va_start(args, log_msg);
+    vsnprintf(msg, sizeof(msg), log_msg, args);
+    va_end(args);
+    if (log_file) {
+        fprintf(log_file, "(W)[%s]{%s:%d}\t%s", ts, __FILENAME__, lineno, msg);
+    }
+    fputs(msg, stdout);
+}
+
+static void log_flush_files(void) {
+    if (log_file) {
+        fflush(log_file);
+    }
+    if (evlog_file) {
+        fflush(evlog_file);
+    }
+    fflush(stdout);
+}
+
+/*
+ * Synchronously write any pending record.
+ * Used on errors, to keep logs complete.
+ * log_file is only ever touched while holding the lock, as writer thread may rotate it.
+ */
+void log_flush(void) {
+    log_drain();
+}
+
+/*
+ * Same as log_flush(), called from a fatal signal handler.
+ * If writer thread is stuck holding the lock (eg: it crashed), write anyway:
+ * we are dying, there is nothing left to race with.
+ */
+void log_flush_on_crash(void) {
+    bool locked = false;
+    for (int i = 0; i < 100 && !(locked = pthread_mutex_trylock(&log_drain_mtx) == 0); i++) {
+        nanosleep(&(struct timespec){ 0, 1000 * 1000 }, NULL);
+    }
+    log_write_pending();
+    if (locked) {
+        pthread_mutex_unlock(&log_drain_mtx);
+    }
+}
+
+/* Timestamps have second granularity: only recompute them when second changes */
+static const char *log_timestamp(void) {
+    static time_t cached_t = -1;
+    static char ts[16];
+    const time_t t = time(NULL);
+    if (t != cached_t) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        snprintf(ts, sizeof(ts), "%02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+        cached_t = t;
+    }
+    return ts;
 }
 
 static void log_bl_conf(bl_conf_t *bl_conf) {
@@ -49,6 +341,14 @@ static void log_bl_conf(bl_conf_t *bl_conf) {
     fprintf(log_file, "* Daily timeouts:\t\tAC %d\tBATT %d\n", bl_conf->timeout[ON_AC][DAY], bl_conf->timeout[ON_BATTERY][DAY]);
     fprintf(log_file, "* Nightly timeout:\t\tAC %d\tBATT %d\n", bl_conf->timeout[ON_AC][NIGHT], bl_conf->timeout[ON_BATTERY][NIGHT]);
     fprintf(log_file, "* Event timeouts:\t\tAC %d\tBATT %d\n", bl_conf->timeout[ON_AC][SIZE_STATES], bl_conf->timeout[ON_BATTERY][SIZE_STATES]);
+    for (int i = 0; i < SIZE_AC; i++) {
+        if (bl_conf->has_phase_timeouts[i]) {
+            fprintf(log_file, "* %s phase timeouts:\t\t%d %d %d %d %d\n", i == ON_AC ? "AC" : "BATT",
+                    bl_conf->phase_timeout[i][PHASE_NIGHT], bl_conf->phase_timeout[i][PHASE_ASTRONOMICAL],
+                    bl_conf->phase_timeout[i][PHASE_NAUTICAL], bl_conf->phase_timeout[i][PHASE_CIVIL],
+                    bl_conf->phase_timeout[i][PHASE_DAY]);
+        }
+    }
     fprintf(log_file, "* Backlight path:\t\t%s\n", strlen(bl_conf->screen_path) ? bl_conf->screen_path : "Unset");
     fprintf(log_file, "* Shutter threshold:\t\t%.2lf\n", bl_conf->shutter_threshold);
     fprintf(log_file, "* Autocalibration:\t\t%s\n", bl_conf->no_auto_calib ? "Disabled" : "Enabled");
@@ -66,6 +366,13 @@ static void log_kbd_conf(kbd_conf_t *kbd_conf) {
     fprintf(log_file, "\n### KEYBOARD ###\n");
     fprintf(log_file, "* Dim:\t\t%s\n", kbd_conf->dim ? "Enabled" : "Disabled");
     fprintf(log_file, "* Threshold:\t\t%.2lf\n", kbd_conf->amb_br_thres);
+    fprintf(log_file, "* Smooth trans:\t\t%s\n", kbd_conf->no_smooth ? "Disabled" : "Enabled");
+    fprintf(log_file, "* Smooth steps:\t\t%.2lf\n", kbd_conf->trans_step);
+    fprintf(log_file, "* Smooth timeout:\t\t%d\n", kbd_conf->trans_timeout);
+    fprintf(log_file, "* Curve points:\t\t");
+    for (int i = 0; i < kbd_conf->num_points; i++) {
+        fprintf(log_file, "%.2lf%s", kbd_conf->regression_points[i], i < kbd_conf->num_points - 1 ? ", " : "\n");
+    }
 }
 
 static void log_gamma_conf(gamma_conf_t *gamma_conf) {
@@ -75,8 +382,17 @@ static void log_gamma_conf(gamma_conf_t *gamma_conf) {
     fprintf(log_file, "* Smooth timeout:\t\t%d\n", gamma_conf->trans_timeout);
     fprintf(log_file, "* Daily screen temp:\t\t%d\n", gamma_conf->temp[DAY]);
     fprintf(log_file, "* Nightly screen temp:\t\t%d\n", gamma_conf->temp[NIGHT]);
+    if (gamma_conf->has_phase_temps) {
+        fprintf(log_file, "* Phase screen temps:\t\t%d %d %d %d %d\n", gamma_conf->phase_temp[PHASE_NIGHT], 
+                gamma_conf->phase_temp[PHASE_ASTRONOMICAL], gamma_conf->phase_temp[PHASE_NAUTICAL], 
+                gamma_conf->phase_temp[PHASE_CIVIL], gamma_conf->phase_temp[PHASE_DAY]);
+    }
     fprintf(log_file, "* Long transition:\t\t%s\n", gamma_conf->long_transition ? "Enabled" : "Disabled");
     fprintf(log_file, "* Ambient gamma:\t\t%s\n", gamma_conf->ambient_gamma ? "Enabled" : "Disabled");
+    for (int i = 0; i < gamma_conf->num_outputs; i++) {
+        fprintf(log_file, "* Output '%s' temps:\t\tDAY %d\tNIGHT %d\n", gamma_conf->outputs[i].display, 
+                gamma_conf->outputs[i].temp[DAY], gamma_conf->outputs[i].temp[NIGHT]);
+    }
 }
 
 static void log_daytime_conf(daytime_conf_t *day_conf) {
@@ -100,6 +416,7 @@ static void log_dim_conf(dimmer_conf_t *dim_conf) {
     fprintf(log_file, "* Smooth timeout:\t\tENTER: %d, EXIT: %d\n", dim_conf->trans_timeout[ENTER], dim_conf->trans_timeout[EXIT]);
     fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", dim_conf->timeout[ON_AC], dim_conf->timeout[ON_BATTERY]);
     fprintf(log_file, "* Backlight pct:\t\t%.2lf\n", dim_conf->dimmed_pct);
+    fprintf(log_file, "* Learn timeouts:\t\t%s\n", dim_conf->learn ? "Enabled" : "Disabled");
 }
 
 static void log_dpms_conf(dpms_conf_t *dpms_conf) {
@@ -107,11 +424,20 @@ static void log_dpms_conf(dpms_conf_t *dpms_conf) {
     fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", dpms_conf->timeout[ON_AC], dpms_conf->timeout[ON_BATTERY]);
 }
 
+static void log_hook_conf(idle_hook_conf_t *hook_conf) {
+    fprintf(log_file, "\n### IDLE HOOK ###\n");
+    fprintf(log_file, "* Command:\t\t%s\n", hook_conf->command);
+    fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", hook_conf->timeout[ON_AC], hook_conf->timeout[ON_BATTERY]);
+}
+
 static void log_scr_conf(screen_conf_t *screen_conf) {
     fprintf(log_file, "\n### SCREEN ###\n");
     fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", screen_conf->timeout[ON_AC], screen_conf->timeout[ON_BATTERY]);
     fprintf(log_file, "* Contrib:\t\t%.2lf\n", screen_conf->contrib);
     fprintf(log_file, "* Samples:\t\t%d\n", screen_conf->samples);
+    fprintf(log_file, "* EMA alpha:\t\t%.2lf\n", screen_conf->ema_alpha);
+    fprintf(log_file, "* Damage debounce:\t\t%d\n", screen_conf->damage_debounce);
+    fprintf(log_file, "* Sampling:\t\t%s\n", screen_conf->local_sampling ? "In-process" : "Clightd");
 }
 
 static void log_inh_conf(inh_conf_t *inh_conf) {
@@ -120,8 +446,13 @@ static void log_inh_conf(inh_conf_t *inh_conf) {
     fprintf(log_file, "* PowerManagement:\t\t%s\n", inh_conf->inhibit_pm ? "Enabled" : "Disabled");
 }
 
+/* Written under log lock, as writer thread may rotate log_file meanwhile */
 void log_conf(void) {
+    pthread_mutex_lock(&log_drain_mtx);
     if (log_file) {
+        /* Keep ordering with any already queued record */
+        log_write_pending();
+
         time_t t = time(NULL);
 
         /* Start with a newline if any log is above */
@@ -135,6 +466,17 @@ void log_conf(void) {
         
         fprintf(log_file, "\n### GENERIC ###\n");
         fprintf(log_file, "* Verbose (debug):\t\t%s\n", conf.verbose ? "Enabled" : "Disabled");
+        if (conf.log_max_size > 0) {
+            fprintf(log_file, "* Log rotation:\t\t%d files of %d KB\n", conf.log_max_files, conf.log_max_size);
+        } else {
+            fprintf(log_file, "* Log rotation:\t\tDisabled\n");
+        }
+        if (conf.event_log) {
+            fprintf(log_file, "* Event log size:\t\t%d KB\n", conf.event_log_size);
+        } else {
+            fprintf(log_file, "* Event log:\t\tDisabled\n");
+        }
+        fprintf(log_file, "* Idle backend:\t\t%s\n", conf.local_idle ? "Input devices" : "Clightd");
         
         if (!conf.bl_conf.disabled) {
             log_bl_conf(&conf.bl_conf);
@@ -159,6 +501,10 @@ void log_conf(void) {
            log_dpms_conf(&conf.dpms_conf);
         }
         
+        if (!conf.hook_conf.disabled) {
+            log_hook_conf(&conf.hook_conf);
+        }
+        
         if (!conf.screen_conf.disabled) {
            log_scr_conf(&conf.screen_conf);
         }
@@ -170,37 +516,155 @@ void log_conf(void) {
         fprintf(log_file, "\n");
         fflush(log_file);
     }
+    pthread_mutex_unlock(&log_drain_mtx);
 }
 
-void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
-    if (type != 'D' || conf.verbose) {
-        va_list file_args, args;
+static int log_mod_idx(const char *module) {
+    for (int i = 0; i < LOG_MODS_SIZE; i++) {
+        if (!strcasecmp(module, log_mods[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-        va_start(file_args, log_msg);
-        va_copy(args, file_args);
-        if (log_file) {
-            time_t t = time(NULL);
-            struct tm *tm = localtime(&t);
-            fprintf(log_file, "(%c)[%02d:%02d:%02d]{%s:%d}\t", type, tm->tm_hour, tm->tm_min, tm->tm_sec, filename, lineno);
-            vfprintf(log_file, log_msg, file_args);
-            fflush(log_file);
+/*
+ * Returns pointer to log level of the module implemented in filename,
+ * or to default one. Called once per source file by LOG_ENABLED macro.
+ */
+const int *log_level_ref(const char *filename) {
+    char name[NAME_MAX + 1];
+    snprintf(name, sizeof(name), "%s", filename);
+    char *ext = strrchr(name, '.');
+    if (ext) {
+        *ext = '\0';
+    }
+    const int idx = log_mod_idx(name);
+    return &log_levels[idx != -1 ? idx : LOG_MOD_DEFAULT];
+}
+
+/*
+ * Publish rotation limits to writer thread.
+ * Called once config is loaded, and whenever it is reloaded.
+ */
+void log_set_limits(int max_size, int max_files, int evlog_size) {
+    atomic_store(&log_max_size, max_size);
+    atomic_store(&log_max_files, max_files);
+    atomic_store(&evlog_max_size, evlog_size);
+}
+
+/*
+ * Set log level for module, or default one if module is NULL.
+ * Default level is inherited by any module whose level was not explicitly set.
+ */
+int log_level_set(const char *module, int level) {
+    if (level < LOG_LVL_ERROR || level >= LOG_LVL_SIZE) {
+        return -EINVAL;
+    }
+    if (!module) {
+        for (int i = 0; i < LOG_MODS_SIZE; i++) {
+            if (i == LOG_MOD_DEFAULT || !log_overridden[i]) {
+                log_levels[i] = level;
+            }
         }
+        return 0;
+    }
+    const int idx = log_mod_idx(module);
+    if (idx == -1) {
+        return -ENOENT;
+    }
+    log_levels[idx] = level;
+    log_overridden[idx] = idx != LOG_MOD_DEFAULT;
+    return 0;
+}
+
+int log_level_get(const char *module) {
+    const int idx = module ? log_mod_idx(module) : LOG_MOD_DEFAULT;
+    return idx != -1 ? log_levels[idx] : -ENOENT;
+}
+
+/* Iterate modules with their own log level; returns NULL past last one */
+const char *log_module_name(int idx) {
+    return idx >= 0 && idx < LOG_MODS_SIZE ? log_mods[idx] : NULL;
+}
+
+/* Returns next free record in ring, making room if it is full */
+static log_record_t *log_reserve(void) {
+    const unsigned int head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    if (atomic_load(&log_running) && head - atomic_load_explicit(&log_tail, memory_order_acquire) == LOG_RING_SIZE) {
+        /* Ring is full: make room */
+        log_flush();
+    }
+    return &log_ring[head % LOG_RING_SIZE];
+}
 
-        /* In case of error, log to stdout too */
-        FILE *out = stdout;
-        if (type == 'E') {
-            out = stderr;
+/* Publish last reserved record to writer thread, or write it straight away when logging synchronously */
+static void log_commit(void) {
+    const unsigned int head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    log_record_t *rec = &log_ring[head % LOG_RING_SIZE];
+    if (atomic_load(&log_running)) {
+        atomic_store_explicit(&log_head, head + 1, memory_order_release);
+        if (rec->type == 'E') {
+            log_flush();
+        } else if (head + 1 - atomic_load_explicit(&log_tail, memory_order_relaxed) == LOG_RING_SIZE / 2) {
+            /* Wake writer for a batch */
+            eventfd_write(log_efd, 1);
         }
+    } else {
+        log_write_record(rec);
+        log_flush_files();
+    }
+}
 
-        vfprintf(out, log_msg, args);
-        va_end(args);
-        va_end(file_args);
+void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
+    va_list args;
+    log_record_t *rec = log_reserve();
+    rec->type = type;
+    rec->msg_off = snprintf(rec->text, LOG_RECORD_SIZE, "(%c)[%s]{%s:%d}\t", type, log_timestamp(), filename, lineno);
+    if (rec->msg_off >= LOG_RECORD_SIZE) {
+        rec->msg_off = LOG_RECORD_SIZE - 1;
     }
+    va_start(args, log_msg);
+    vsnprintf(rec->text + rec->msg_off, LOG_RECORD_SIZE - rec->msg_off, log_msg, args);
+    va_end(args);
+    log_commit();
+}
+
+/* Queue a binary event log record for the module implemented in filename */
+void log_event(const char *filename, int type, double value) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const evlog_record_t ev = {
+        .ts_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000,
+        .module = log_level_ref(filename) - log_levels,
+        .type = type,
+        .value = value
+    };
+    
+    log_record_t *rec = log_reserve();
+    rec->type = 'B';
+    rec->msg_off = 0;
+    memcpy(rec->text, &ev, sizeof(ev));
+    log_commit();
 }
 
 void close_log(void) {
+    if (atomic_exchange(&log_running, false)) {
+        eventfd_write(log_efd, 1);
+        pthread_join(log_thread, NULL);
+    }
+    log_drain();
+    if (log_efd >= 0) {
+        close(log_efd);
+        log_efd = -1;
+    }
+    if (evlog_file) {
+        fclose(evlog_file);
+        evlog_file = NULL;
+    }
     if (log_file) {
         flock(fileno(log_file), LOCK_UN);
         fclose(log_file);
+        log_file = NULL;
     }
 }
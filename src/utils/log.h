@@ -1,6 +1,7 @@
 #pragma once
 
 #include <setjmp.h>
+#include "evlog.h"
 
 /* ERROR macro will leave clight by calling modules_quit; thus it is not exposed to public header */
 #define ERROR(msg, ...) \
@@ -10,6 +11,20 @@ do { \
     else longjmp(state.quit_buf, EXIT_FAILURE); \
 } while (0)
 
+/* Append a record to binary event log, when enabled. See evlog.h. */
+#define EVLOG(type, val) \
+do { \
+    if (conf.event_log) log_event(__FILENAME__, type, val); \
+} while (0)
+
 void open_log(void);
+void open_evlog(void);
+void log_event(const char *filename, int type, double value);
 void log_conf(void);
+void log_flush(void);
+void log_flush_on_crash(void);
+void log_set_limits(int max_size, int max_files, int evlog_size);
+int log_level_set(const char *module, int level);
+int log_level_get(const char *module);
+const char *log_module_name(int idx);
 void close_log(void);
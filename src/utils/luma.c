@@ -0,0 +1,107 @@
+#include "luma.h"
+
+/*
+ * Sum of weighted luma of n 32bpp xRGB pixels (host byte order).
+ * On x86, SSE2 (baseline) or AVX2 (when supported by the cpu) kernels are used,
+ * falling back at the scalar one elsewhere.
+ * SIMD kernels accumulate on 32b lanes: flush them every BLOCK pixels to avoid overflows.
+ */
+
+#define BLOCK 16384
+
+typedef uint64_t (*luma_fn)(const uint32_t *px, size_t n);
+
+static luma_fn resolve(void);
+
+static luma_fn kernel;
+static const char *kernel_name;
+
+uint64_t luma_sum_scalar(const uint32_t *px, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += ((px[i] >> 16) & 0xFF) * LUMA_R + ((px[i] >> 8) & 0xFF) * LUMA_G + (px[i] & 0xFF) * LUMA_B;
+    }
+    return sum;
+}
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+
+#include <immintrin.h>
+
+/* Each pixel is B, G, R, X bytes: once widened to 16b, madd gives (B*wb + G*wg), (R*wr + X*0) */
+static uint64_t luma_sum_sse2(const uint32_t *px, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set_epi16(0, LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B);
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        const size_t end = i + BLOCK < n ? i + BLOCK : n;
+        __m128i acc = zero;
+        for (; i + 4 <= end; i += 4) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(px + i));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), w));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), w));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + luma_sum_scalar(px + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t luma_sum_avx2(const uint32_t *px, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i w = _mm256_set_epi16(0, LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B,
+                                       0, LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B);
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i + 8 <= n) {
+        const size_t end = i + BLOCK < n ? i + BLOCK : n;
+        __m256i acc = zero;
+        for (; i + 8 <= end; i += 8) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *)(px + i));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_unpacklo_epi8(v, zero), w));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_unpackhi_epi8(v, zero), w));
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (int l = 0; l < 8; l++) {
+            sum += lanes[l];
+        }
+    }
+    return sum + luma_sum_scalar(px + i, n - i);
+}
+
+static luma_fn resolve(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel_name = "avx2";
+        return luma_sum_avx2;
+    }
+    kernel_name = "sse2";
+    return luma_sum_sse2;
+}
+
+#else
+
+static luma_fn resolve(void) {
+    kernel_name = "scalar";
+    return luma_sum_scalar;
+}
+
+#endif
+
+uint64_t luma_sum(const uint32_t *px, size_t n) {
+    if (!kernel) {
+        kernel = resolve();
+    }
+    return kernel(px, n);
+}
+
+const char *luma_kernel(void) {
+    if (!kernel) {
+        kernel = resolve();
+    }
+    return kernel_name;
+}
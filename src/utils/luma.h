@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* BT.709 luma weights, scaled to 256: a white pixel weighs LUMA_MAX */
+#define LUMA_R 54
+#define LUMA_G 183
+#define LUMA_B 19
+#define LUMA_MAX (255 * 256)
+
+uint64_t luma_sum(const uint32_t *px, size_t n);
+uint64_t luma_sum_scalar(const uint32_t *px, size_t n);
+const char *luma_kernel(void);
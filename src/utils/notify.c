@@ -0,0 +1,39 @@
+#include <systemd/sd-daemon.h>
+#include "notify.h"
+
+static int ready_steps;
+static bool notified;
+
+/*
+ * Mark a startup step as done.
+ * Once INTERFACE owns its bus names and first backlight level is set,
+ * tell service manager (when started as a Type=notify unit) that we are ready.
+ * Steps belonging to modules that won't start are not waited for.
+ */
+void notify_ready(enum ready_steps step) {
+    ready_steps |= step;
+    
+    int needed = 0;
+    if (!conf.wizard) {
+        needed |= READY_INTERFACE;
+        if (!conf.bl_conf.disabled) {
+            needed |= READY_BACKLIGHT;
+        }
+    }
+    if ((ready_steps & needed) == needed) {
+        notify_ready_force();
+    }
+}
+
+/* Notify readiness even if some step is still missing */
+void notify_ready_force(void) {
+    if (!notified) {
+        notified = true;
+        sd_notify(0, "READY=1\nSTATUS=Running.");
+        DEBUG("Ready.\n");
+    }
+}
+
+bool notify_is_ready(void) {
+    return notified;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "commons.h"
+
+/* Startup steps needed before notifying service manager that clight is ready */
+enum ready_steps { READY_INTERFACE = 1, READY_BACKLIGHT = 2 };
+
+void notify_ready(enum ready_steps step);
+void notify_ready_force(void);
+bool notify_is_ready(void);
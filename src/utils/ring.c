@@ -0,0 +1,69 @@
+#include "ring.h"
+
+static void kahan_add(ring_t *r, double val);
+
+int ring_init(ring_t *r, int size, double alpha) {
+    memset(r, 0, sizeof(ring_t));
+    r->data = calloc(size, sizeof(double));
+    if (!r->data) {
+        return -ENOMEM;
+    }
+    r->size = size;
+    r->alpha = alpha;
+    return 0;
+}
+
+static void kahan_add(ring_t *r, double val) {
+    const double y = val - r->comp;
+    const double t = r->sum + y;
+    r->comp = (t - r->sum) - y;
+    r->sum = t;
+}
+
+/*
+ * Replace oldest sample with val, updating running sum and EMA in O(1).
+ */
+void ring_push(ring_t *r, double val) {
+    kahan_add(r, -r->data[r->ctr]);
+    kahan_add(r, val);
+    r->data[r->ctr] = val;
+    r->ctr = (r->ctr + 1) % r->size;
+    
+    if (r->count == 0) {
+        r->ema = val;
+    } else {
+        r->ema += r->alpha * (val - r->ema);
+    }
+    if (r->count < r->size) {
+        r->count++;
+    }
+}
+
+/*
+ * Mean over the whole buffer (not yet pushed samples count as 0),
+ * or exponential moving average if enabled.
+ */
+double ring_mean(const ring_t *r) {
+    if (r->alpha > 0) {
+        return r->ema;
+    }
+    return r->sum / r->size;
+}
+
+bool ring_full(const ring_t *r) {
+    return r->count == r->size;
+}
+
+void ring_reset(ring_t *r) {
+    memset(r->data, 0, r->size * sizeof(double));
+    r->ctr = 0;
+    r->count = 0;
+    r->sum = 0;
+    r->comp = 0;
+    r->ema = 0;
+}
+
+void ring_destroy(ring_t *r) {
+    free(r->data);
+    r->data = NULL;
+}
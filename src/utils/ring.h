@@ -0,0 +1,27 @@
+#pragma once
+
+#include "commons.h"
+
+/*
+ * Fixed size ring buffer of samples, keeping a Kahan-compensated running sum
+ * so that mean is available in O(1) regardless of its size.
+ * If alpha > 0, an exponential moving average with alpha as newest sample weight
+ * is kept too, and returned by ring_mean() in place of the plain mean.
+ */
+typedef struct {
+    double *data;
+    int size;
+    int ctr;                    // next slot to be written
+    int count;                  // number of samples pushed, up to size
+    double sum;                 // running sum of data
+    double comp;                // Kahan compensation of sum
+    double alpha;               // EMA weight of newest sample, 0 to disable
+    double ema;                 // exponential moving average
+} ring_t;
+
+int ring_init(ring_t *r, int size, double alpha);
+void ring_push(ring_t *r, double val);
+double ring_mean(const ring_t *r);
+bool ring_full(const ring_t *r);
+void ring_reset(ring_t *r);
+void ring_destroy(ring_t *r);
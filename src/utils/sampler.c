@@ -0,0 +1,177 @@
+#include "sampler.h"
+
+/*
+ * In-process screen-emitted brightness sampling, through X Shm extension:
+ * only MAX_ROWS evenly spaced rows of root window are grabbed, one at a time,
+ * into a single row shared memory image, and reduced to their average luma.
+ * When Clight is built without it, sampler_init() fails
+ * and callers fallback at Clightd; a lost X connection is reported
+ * by sampler_get_brightness() instead of letting Xlib exit the process.
+ */
+
+#ifdef XSHM_PRESENT
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include "luma.h"
+
+#define MAX_ROWS 64                         // rows grabbed for each sample, each costing an X roundtrip
+
+static int create_image(int width);
+static void destroy_image(void);
+static int on_x_error(Display *d, XErrorEvent *ev);
+static void on_io_error(Display *d, void *userdata);
+
+static Display *dpy;
+static XImage *img;
+static XShmSegmentInfo shminfo = { .shmid = -1, .shmaddr = (char *)-1 };
+static bool x_error, io_error;
+
+/* Open X connection on state.display; returns 0 if in-process sampling is available */
+int sampler_init(void) {
+    if (state.wl_display) {
+        /* XWayland root window does not see Wayland clients */
+        return -ENOTSUP;
+    }
+    dpy = XOpenDisplay(state.display);
+    if (!dpy) {
+        return -ENODEV;
+    }
+    io_error = false;
+    XSetIOErrorExitHandler(dpy, on_io_error, NULL);
+    if (!XShmQueryExtension(dpy)) {
+        sampler_destroy();
+        return -ENOTSUP;
+    }
+    /* Default handler would exit on a failed grab (eg: while screen is being resized) */
+    XSetErrorHandler(on_x_error);
+    
+    XWindowAttributes attrs;
+    XGetWindowAttributes(dpy, DefaultRootWindow(dpy), &attrs);
+    int r = create_image(attrs.width);
+    if (r != 0) {
+        sampler_destroy();
+    }
+    return r;
+}
+
+/* Average luma of the screen, between 0 and 1; -ENOTCONN if X connection was lost */
+int sampler_get_brightness(double *br) {
+    XWindowAttributes attrs;
+    if (!XGetWindowAttributes(dpy, DefaultRootWindow(dpy), &attrs) || io_error) {
+        return io_error ? -ENOTCONN : -EIO;
+    }
+    if (attrs.width != img->width) {
+        /* Screen was resized */
+        destroy_image();
+        if (create_image(attrs.width) != 0) {
+            return -ENOMEM;
+        }
+    }
+    
+    const int stride = attrs.height > MAX_ROWS ? attrs.height / MAX_ROWS : 1;
+    uint64_t sum = 0;
+    int rows = 0;
+    x_error = false;
+    for (int y = stride / 2; y < attrs.height; y += stride, rows++) {
+        if (!XShmGetImage(dpy, DefaultRootWindow(dpy), img, 0, y, AllPlanes) || x_error || io_error) {
+            return io_error ? -ENOTCONN : -EIO;
+        }
+        sum += luma_sum((const uint32_t *)img->data, img->width);
+    }
+    *br = (double)sum / ((double)rows * img->width * LUMA_MAX);
+    return 0;
+}
+
+void sampler_destroy(void) {
+    if (dpy) {
+        destroy_image();
+        /* Does not talk to X server anymore after an IO error */
+        XCloseDisplay(dpy);
+        dpy = NULL;
+    }
+}
+
+/* Single row image; only 32bpp xRGB visuals are supported, ie: any common 24/32 depth one */
+static int create_image(int width) {
+    img = XShmCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), DefaultDepth(dpy, DefaultScreen(dpy)), 
+                          ZPixmap, NULL, &shminfo, width, 1);
+    if (!img) {
+        return -ENOMEM;
+    }
+    if (img->bits_per_pixel != 32 || img->red_mask != 0xFF0000 || img->blue_mask != 0xFF) {
+        destroy_image();
+        return -ENOTSUP;
+    }
+    
+    shminfo.shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * img->height, IPC_CREAT | 0600);
+    if (shminfo.shmid == -1) {
+        destroy_image();
+        return -errno;
+    }
+    shminfo.shmaddr = img->data = shmat(shminfo.shmid, NULL, 0);
+    shminfo.readOnly = False;
+    if (shminfo.shmaddr == (char *)-1) {
+        destroy_image();
+        return -errno;
+    }
+    
+    x_error = false;
+    XShmAttach(dpy, &shminfo);
+    XSync(dpy, False);
+    /* Segment is freed as soon as both X server and we detach from it */
+    shmctl(shminfo.shmid, IPC_RMID, NULL);
+    if (x_error) {
+        /* Eg: remote X server */
+        destroy_image();
+        return -ENOTSUP;
+    }
+    return 0;
+}
+
+static void destroy_image(void) {
+    if (shminfo.shmaddr != (char *)-1) {
+        if (!io_error) {
+            XShmDetach(dpy, &shminfo);
+        }
+        shmdt(shminfo.shmaddr);
+        shminfo.shmaddr = (char *)-1;
+    } else if (shminfo.shmid != -1) {
+        shmctl(shminfo.shmid, IPC_RMID, NULL);
+    }
+    shminfo.shmid = -1;
+    if (img) {
+        img->data = NULL;
+        XDestroyImage(img);
+        img = NULL;
+    }
+}
+
+static int on_x_error(UNUSED Display *d, UNUSED XErrorEvent *ev) {
+    x_error = true;
+    return 0;
+}
+
+/* Called in place of exit() once Xlib reported an IO error on dpy */
+static void on_io_error(UNUSED Display *d, UNUSED void *userdata) {
+    io_error = true;
+}
+
+#else
+
+int sampler_init(void) {
+    return -ENOTSUP;
+}
+
+int sampler_get_brightness(double *br) {
+    return -ENOTSUP;
+}
+
+void sampler_destroy(void) {
+    
+}
+
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "commons.h"
+
+int sampler_init(void);
+int sampler_get_brightness(double *br);
+void sampler_destroy(void);
@@ -0,0 +1,74 @@
+#include "solar.h"
+
+#define DEG_TO_RAD (M_PI / 180.0)
+#define RAD_TO_DEG (180.0 / M_PI)
+#define DEG_PER_HOUR 15.0               // 360 degree / 24 hours = 15 degrees/h
+
+/*
+ * Double precision computation of the time at which the sun crosses
+ * "elevation" degrees, rising or setting, for b->len days at once.
+ * Use SOLAR_ELEV_HORIZON for sunrise/sunset, lower values for twilights.
+ * See: http://stackoverflow.com/questions/7064531/sunrise-sunset-times-in-c
+ * Anything that only depends on location or event is hoisted out of the loop,
+ * and the loop body is kept branchless (quadrant/range fixes use floor(),
+ * hour angle is clamped). Note that compilers do not vectorize it,
+ * as it calls libm trigonometric functions.
+ * Caller must check b->cos_h[i] to know whether an event exists for b->day[i].
+ */
+void solar_compute_batch(const double lat, const double lng, enum day_events event, const double elevation, solar_batch_t *b) {
+    const double lng_hour = lng / DEG_PER_HOUR;
+    const double t_off = ((event == SUNRISE ? 6.0 : 18.0) - lng_hour) / 24.0;
+    /* Sunrise: H = 360 - acos(cosH); Sunset: H = acos(cosH) */
+    const double h_off = event == SUNRISE ? 360.0 : 0.0;
+    const double h_sign = event == SUNRISE ? -1.0 : 1.0;
+    const double sin_zenith = sin(elevation * DEG_TO_RAD);
+    const double sin_lat = sin(lat * DEG_TO_RAD);
+    const double cos_lat = cos(lat * DEG_TO_RAD);
+    
+    const double *restrict day = b->day;
+    double *restrict ut = b->ut;
+    double *restrict cos_h = b->cos_h;
+    for (size_t i = 0; i < b->len; i++) {
+        // 1. approximate time
+        const double t = day[i] + t_off;
+        
+        // 2. Sun's mean anomaly
+        const double m = (0.9856 * t) - 3.289;
+        
+        // 3. Sun's true longitude, in [0, 360)
+        double l = m + 1.916 * sin(m * DEG_TO_RAD) + 0.020 * sin(2 * m * DEG_TO_RAD) + 282.634;
+        l -= 360.0 * floor(l / 360.0);
+        
+        // 4. Sun's right ascension, in the same quadrant as l, in hours
+        double ra = RAD_TO_DEG * atan(0.91764 * tan(l * DEG_TO_RAD));
+        ra += 90.0 * (floor(l / 90.0) - floor(ra / 90.0));
+        ra /= DEG_PER_HOUR;
+        
+        // 5. Sun's declination
+        const double sin_dec = 0.39782 * sin(l * DEG_TO_RAD);
+        const double cos_dec = sqrt(1.0 - sin_dec * sin_dec);
+        
+        // 6. Sun's local hour angle, in hours
+        cos_h[i] = (sin_zenith - sin_dec * sin_lat) / (cos_dec * cos_lat);
+        const double h = (h_off + h_sign * RAD_TO_DEG * acos(fmax(-1.0, fmin(1.0, cos_h[i])))) / DEG_PER_HOUR;
+        
+        // 7. local mean time of rising/setting, adjusted back to UTC in [0, 24)
+        double u = h + ra - (0.06571 * t) - 6.622 - lng_hour;
+        u -= 24.0 * floor(u / 24.0);
+        ut[i] = u;
+    }
+}
+
+/*
+ * Single day helper around solar_compute_batch().
+ * Returns -2 if sun does not cross elevation on requested day (eg: polar day/night).
+ */
+int solar_compute(const double lat, const double lng, enum day_events event, const double elevation, const double day, double *ut) {
+    double cos_h;
+    solar_batch_t b = { 1, &day, ut, &cos_h };
+    solar_compute_batch(lat, lng, event, elevation, &b);
+    if (cos_h > 1.0 || cos_h < -1.0) {
+        return -2; // no sunrise/sunset today!
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "commons.h"
+
+#define SOLAR_ELEV_HORIZON -0.83        // sun elevation at sunrise/sunset, accounting for refraction and sun disc
+
+/*
+ * Structure of arrays used for batch evaluation:
+ * one slot per day, so that each array can be walked linearly.
+ */
+typedef struct {
+    size_t len;
+    const double *day;          // [in] day of the year (tm_yday, can be shifted outside [0, 365])
+    double *ut;                 // [out] event time in UTC hours, in [0, 24)
+    double *cos_h;              // [out] cosine of sun local hour angle; event only exists if it is in [-1, 1]
+} solar_batch_t;
+
+void solar_compute_batch(const double lat, const double lng, enum day_events event, const double elevation, solar_batch_t *b);
+int solar_compute(const double lat, const double lng, enum day_events event, const double elevation, const double day, double *ut);
@@ -0,0 +1,101 @@
+/*
+ * Decoder for clight binary event log (see src/utils/evlog.h).
+ * Prints records as CSV (default) or JSON lines; in JSON, non finite values are null.
+ * Usage: clight-evlog [--json] file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "evlog.h"
+
+static int decode(const char *path, int json);
+
+int main(int argc, char *argv[]) {
+    int json = 0, ret = EXIT_SUCCESS, files = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+            printf("Usage: %s [--json] file...\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    if (!json) {
+        printf("ts_us,module,event,value\n");
+    }
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            files++;
+            if (decode(argv[i], json) != 0) {
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+    if (!files) {
+        fprintf(stderr, "Usage: %s [--json] file...\n", argv[0]);
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
+
+static int decode(const char *path, int json) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    int ret = 0;
+    char (*mods)[EVLOG_MOD_NAME_LEN + 1] = NULL;
+    evlog_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, EVLOG_MAGIC, sizeof(hdr.magic))) {
+        fprintf(stderr, "%s: not a clight event log.\n", path);
+        ret = -1;
+        goto end;
+    }
+    if (hdr.version != EVLOG_VERSION || hdr.record_size != sizeof(evlog_record_t)) {
+        fprintf(stderr, "%s: unsupported event log version %u (record size %u).\n", path, hdr.version, hdr.record_size);
+        ret = -1;
+        goto end;
+    }
+
+    mods = calloc(hdr.num_mods, sizeof(*mods));
+    if (!mods && hdr.num_mods) {
+        perror(path);
+        ret = -1;
+        goto end;
+    }
+    for (int i = 0; i < hdr.num_mods; i++) {
+        if (fread(mods[i], EVLOG_MOD_NAME_LEN, 1, f) != 1) {
+            fprintf(stderr, "%s: truncated header.\n", path);
+            ret = -1;
+            goto end;
+        }
+    }
+
+    evlog_record_t ev;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) {
+        const char *mod = ev.module < hdr.num_mods ? mods[ev.module] : "unknown";
+        const char *type = ev.type < EVLOG_SIZE ? evlog_type_names[ev.type] : "unknown";
+        if (json) {
+            printf("{\"ts_us\":%" PRIu64 ",\"module\":\"%s\",\"event\":\"%s\",\"value\":", ev.ts_us, mod, type);
+            /* JSON has no NaN nor Infinity */
+            if (isfinite(ev.value)) {
+                printf("%.17g}\n", ev.value);
+            } else {
+                printf("null}\n");
+            }
+        } else {
+            printf("%" PRIu64 ",%s,%s,%.17g\n", ev.ts_us, mod, type, ev.value);
+        }
+    }
+
+end:
+    free(mods);
+    fclose(f);
+    return ret;
+}